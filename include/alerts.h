@@ -0,0 +1,219 @@
+/*
+alerts
+
+rolling min/max/mean/rate over a window of samples, updated in O(1) per
+sample (monotonic queues for min/max, running sum for mean). every rule has
+its own window (and sample period), rules with hysteresis are checked on
+every sample of their window, transitions are flagged in 'changed' so
+they're published once.
+*/
+
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <stdint.h>
+
+// max samples in a window / rules
+#define ALERT_SAMPLES 60
+#define ALERT_RULES 3
+// fastest sample period (ms)
+#define ALERT_PERIOD 10000UL
+// window limits (s)
+#define ALERT_WINDOW_MIN 10
+#define ALERT_WINDOW_MAX 65535
+
+enum { ALERT_TEMPERATURE, ALERT_HUMIDITY, ALERT_METRICS };
+enum { ALERT_VALUE, ALERT_MEAN, ALERT_MIN, ALERT_MAX, ALERT_RATE };
+enum { ALERT_ABOVE, ALERT_BELOW };
+
+// valid window (s)
+inline uint16_t alert_window(long s) {
+  return (s < ALERT_WINDOW_MIN)   ? ALERT_WINDOW_MIN
+         : (s > ALERT_WINDOW_MAX) ? ALERT_WINDOW_MAX
+                                  : s;
+}
+
+struct alert_rule {
+  bool enabled = false;
+  uint16_t window = 600; // s
+  unsigned int metric = ALERT_TEMPERATURE;
+  unsigned int stat = ALERT_VALUE;
+  unsigned int op = ALERT_ABOVE;
+  float threshold = 30;
+  float hysteresis = 0.5;
+};
+
+class RollingStats {
+public:
+  RollingStats() { resize(ALERT_SAMPLES); }
+
+  // window in samples, clears data
+  void resize(unsigned int n) {
+    window = (n < 1) ? 1 : (n > ALERT_SAMPLES) ? ALERT_SAMPLES : n;
+    seq = 0;
+    sum = 0;
+    min_head = min_tail = max_head = max_tail = 0;
+  }
+
+  void add(float v, unsigned long t) {
+    unsigned long s = seq++;
+    // drop sample leaving the window
+    if (s >= window) {
+      unsigned long old = s - window;
+      sum -= values[old % ALERT_SAMPLES];
+      if (minq[min_head % ALERT_SAMPLES] == old) {
+        min_head++;
+      }
+      if (maxq[max_head % ALERT_SAMPLES] == old) {
+        max_head++;
+      }
+    }
+    values[s % ALERT_SAMPLES] = v;
+    times[s % ALERT_SAMPLES] = t;
+    sum += v;
+    // keep queues monotonic
+    while ((min_tail != min_head) &&
+           (values[minq[(min_tail - 1) % ALERT_SAMPLES] % ALERT_SAMPLES] >=
+            v)) {
+      min_tail--;
+    }
+    minq[min_tail++ % ALERT_SAMPLES] = s;
+    while ((max_tail != max_head) &&
+           (values[maxq[(max_tail - 1) % ALERT_SAMPLES] % ALERT_SAMPLES] <=
+            v)) {
+      max_tail--;
+    }
+    maxq[max_tail++ % ALERT_SAMPLES] = s;
+  }
+
+  unsigned int size() const { return (seq < window) ? seq : window; }
+  float last() const { return seq ? values[(seq - 1) % ALERT_SAMPLES] : 0; }
+  float mean() const { return seq ? sum / size() : 0; }
+  float min() const {
+    return seq ? values[minq[min_head % ALERT_SAMPLES] % ALERT_SAMPLES] : 0;
+  }
+  float max() const {
+    return seq ? values[maxq[max_head % ALERT_SAMPLES] % ALERT_SAMPLES] : 0;
+  }
+
+  // change per hour, oldest to newest sample
+  float rate() const {
+    if (size() < 2) {
+      return 0;
+    }
+    unsigned int o = (seq - size()) % ALERT_SAMPLES;
+    unsigned int n = (seq - 1) % ALERT_SAMPLES;
+    unsigned long dt = times[n] - times[o];
+    return dt ? (values[n] - values[o]) * 3600000.0 / dt : 0;
+  }
+
+  float get(unsigned int stat) const {
+    switch (stat) {
+    case ALERT_MEAN:
+      return mean();
+    case ALERT_MIN:
+      return min();
+    case ALERT_MAX:
+      return max();
+    case ALERT_RATE:
+      return rate();
+    default:
+      return last();
+    }
+  }
+
+private:
+  unsigned int window;
+  unsigned long seq;
+  double sum;
+  float values[ALERT_SAMPLES];
+  unsigned long times[ALERT_SAMPLES];
+  // sample numbers, oldest at head
+  unsigned long minq[ALERT_SAMPLES];
+  unsigned long maxq[ALERT_SAMPLES];
+  unsigned long min_head, min_tail, max_head, max_tail;
+};
+
+class Alerts {
+public:
+  Alerts() : changed(0), rules(nullptr) {
+    for (int i = 0; i < ALERT_RULES; i++) {
+      state[i] = false;
+      values[i] = 0;
+      interval[i] = ALERT_PERIOD;
+      sampled[i] = 0;
+    }
+  }
+
+  // sample period of a rule grows with its window
+  void begin(const alert_rule *r) {
+    rules = r;
+    for (int i = 0; i < ALERT_RULES; i++) {
+      unsigned long ms = alert_window(r[i].window) * 1000UL;
+      interval[i] = ms / ALERT_SAMPLES;
+      if (interval[i] < ALERT_PERIOD) {
+        interval[i] = ALERT_PERIOD;
+      }
+      stats[i].resize(ms / interval[i]);
+      sampled[i] = 0;
+    }
+  }
+
+  // ms between sensor reads (fastest enabled rule)
+  unsigned long period() const {
+    unsigned long p = 0;
+    for (int i = 0; rules && (i < ALERT_RULES); i++) {
+      if (rules[i].enabled && (!p || (interval[i] < p))) {
+        p = interval[i];
+      }
+    }
+    return p ? p : ALERT_PERIOD;
+  }
+
+  void add(float temperature, float humidity, unsigned long t) {
+    if (!rules) {
+      return;
+    }
+    for (int i = 0; i < ALERT_RULES; i++) {
+      const alert_rule &r = rules[i];
+      bool on = false;
+      if (r.enabled && (r.metric < ALERT_METRICS)) {
+        // rule isnt due yet
+        if (sampled[i] && (t - sampled[i] < interval[i])) {
+          continue;
+        }
+        sampled[i] = t ? t : 1;
+        stats[i].add((r.metric == ALERT_HUMIDITY) ? humidity : temperature,
+                     t);
+        float v = values[i] = stats[i].get(r.stat);
+        if (r.op == ALERT_BELOW) {
+          on = state[i] ? (v < r.threshold + r.hysteresis) : (v < r.threshold);
+        } else {
+          on = state[i] ? (v > r.threshold - r.hysteresis) : (v > r.threshold);
+        }
+      }
+      if (on != state[i]) {
+        state[i] = on;
+        changed |= 1 << i;
+      }
+    }
+  }
+
+  bool active(int i) const { return state[i]; }
+  float value(int i) const { return values[i]; }
+  const RollingStats &rule_stats(int i) const { return stats[i]; }
+
+  // rules that changed state and werent published yet
+  unsigned int changed;
+
+private:
+  const alert_rule *rules;
+  bool state[ALERT_RULES];
+  float values[ALERT_RULES];
+  // per rule: window samples, ms between them, time of last one
+  RollingStats stats[ALERT_RULES];
+  unsigned long interval[ALERT_RULES];
+  unsigned long sampled[ALERT_RULES];
+};
+
+#endif
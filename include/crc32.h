@@ -0,0 +1,29 @@
+/*
+CRC-32 (IEEE, the gzip/zip one)
+
+a nibble at a time with a 16 entry table: 64 bytes of flash instead of
+1 KB, fast enough for gzip output and RTC memory checks. start with
+0xffffffff, invert when done.
+*/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+inline uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+  static const uint32_t t[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  const uint8_t *p = (const uint8_t *)data;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ t[crc & 15];
+    crc = (crc >> 4) ^ t[crc & 15];
+  }
+  return crc;
+}
+
+#endif
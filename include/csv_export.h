@@ -0,0 +1,135 @@
+/*
+CSV export job
+
+writes history entries [first, end) of a binary cache file to a CSV, a few
+rows per slice, so loop() keeps running while a month is exported. rows go
+to "<name>.tmp", renamed over the CSV when complete: downloads and imports
+never see a partial file.
+*/
+
+#ifndef CSV_EXPORT_H
+#define CSV_EXPORT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "history.h"
+#include "scheduler.h"
+#include "storage.h"
+
+#define CSV_EXPORT_JOBS 2
+#define CSV_EXPORT_BATCH 8
+#define CSV_EXPORT_BUFFER 512
+
+class CsvExport {
+public:
+  CsvExport(Storage &storage) : storage(storage), jobs_count(0), used(0) {}
+
+  // queue an export, src is removed when done if remove_src
+  bool add(const char *src, unsigned int first, unsigned int end,
+           const char *name, bool remove_src) {
+    if (jobs_count >= CSV_EXPORT_JOBS) {
+      return false;
+    }
+    Job &j = jobs[jobs_count++];
+    snprintf(j.src, sizeof(j.src), "%s", src);
+    snprintf(j.name, sizeof(j.name), "%s", name);
+    j.first = j.next = first;
+    j.end = end;
+    j.remove_src = remove_src;
+    return true;
+  }
+
+  bool busy() const { return jobs_count; }
+
+  // run till done (or till scheduler slice is over), true if more work
+  bool run(const Scheduler *sched = nullptr) {
+    while (jobs_count) {
+      Job &j = jobs[0];
+      if (j.next == j.first) {
+        // new file, CSV header
+        storage.remove(tmp());
+        used = 0;
+        write("Hora, Data, Temperatura, Umidade\n");
+      }
+
+      // read a batch of entries
+      TH_INFO e[CSV_EXPORT_BATCH];
+      unsigned int n = j.end - j.next;
+      if (n > CSV_EXPORT_BATCH) {
+        n = CSV_EXPORT_BATCH;
+      }
+      n = storage.read(j.src, j.next * sizeof(TH_INFO), e,
+                       n * sizeof(TH_INFO)) /
+          sizeof(TH_INFO);
+      for (unsigned int i = 0; i < n; i++) {
+        char buf[64];
+        char line[96];
+        strftime(buf, sizeof(buf), "%T, %d-%m-%Y", localtime(&e[i].tempo));
+        snprintf(line, sizeof(line), "%s, %.01f, %.01f\n", buf,
+                 e[i].temperature, e[i].humidity);
+        write(line);
+      }
+      j.next += n;
+
+      // done (or source is shorter than expected)
+      if (!n || (j.next >= j.end)) {
+        flush();
+        storage.rename(tmp(), j.name);
+        if (j.remove_src) {
+          storage.remove(j.src);
+        }
+        jobs_count--;
+        memmove(&jobs[0], &jobs[1], jobs_count * sizeof(Job));
+      }
+
+      if (sched && sched->yield()) {
+        break;
+      }
+    }
+    return jobs_count;
+  }
+
+private:
+  struct Job {
+    char src[32];
+    char name[32];
+    unsigned int first;
+    unsigned int next;
+    unsigned int end;
+    bool remove_src;
+  };
+
+  // file being written (current job)
+  const char *tmp() {
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", jobs[0].name);
+    return tmp_name;
+  }
+
+  // coalesce rows, write in big blocks
+  void write(const char *s) {
+    size_t l = strlen(s);
+    if (used + l > sizeof(out)) {
+      flush();
+    }
+    memcpy(out + used, s, l);
+    used += l;
+  }
+
+  void flush() {
+    if (used) {
+      storage.append(tmp(), out, used);
+      used = 0;
+    }
+  }
+
+  Storage &storage;
+  Job jobs[CSV_EXPORT_JOBS];
+  size_t jobs_count;
+  char out[CSV_EXPORT_BUFFER];
+  size_t used;
+  char tmp_name[40];
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+CSV import job
+
+turns monthly CSV archives (/MMYYYY.csv, as written by CsvExport) back
+into binary history files (/MMYYYY.bin, TH_INFO entries like /CACHE), so
+old months can be read with History at binary speed. the CSV is parsed a
+block per slice with constant memory; output goes to a .tmp file renamed
+when complete.
+*/
+
+#ifndef CSV_IMPORT_H
+#define CSV_IMPORT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "csv_row.h"
+#include "history.h"
+#include "scheduler.h"
+#include "storage.h"
+
+#define CSV_IMPORT_JOBS 4
+#define CSV_IMPORT_BUFFER 256
+#define CSV_IMPORT_BATCH 16
+#define CSV_IMPORT_LINE 64
+
+class CsvImport {
+public:
+  CsvImport(Storage &storage)
+      : rows(0), errors(0), storage(storage), jobs_count(0), rescan(false),
+        line_len(0), used(0) {}
+
+  // queue a monthly CSV, false if it isnt one (or queue is full).
+  // an already queued one starts over (it was uploaded again)
+  bool add(const char *csv) {
+    int m, y;
+    if ((strlen(csv) != 11) || strcmp(csv + 7, ".csv") ||
+        (sscanf(csv, "/%2d%4d", &m, &y) != 2)) {
+      return false;
+    }
+    for (size_t i = 0; i < jobs_count; i++) {
+      if (!strcmp(jobs[i].src, csv)) {
+        // run() drops the .tmp
+        jobs[i].pos = 0;
+        return true;
+      }
+    }
+    if (jobs_count >= CSV_IMPORT_JOBS) {
+      rescan = true;
+      return false;
+    }
+    Job &j = jobs[jobs_count++];
+    snprintf(j.src, sizeof(j.src), "%s", csv);
+    snprintf(j.name, sizeof(j.name), "/%02d%04d.bin", m, y);
+    j.pos = 0;
+    return true;
+  }
+
+  // queue every monthly CSV that has no binary file yet (and isnt being
+  // rewritten)
+  void scan() {
+    rescan = false;
+    storage.list(found, this);
+  }
+
+  bool busy() const { return jobs_count; }
+
+  // run till done (or till scheduler slice is over), true if more work
+  bool run(const Scheduler *sched = nullptr) {
+    while (jobs_count) {
+      Job &j = jobs[0];
+      char tmp[40];
+      snprintf(tmp, sizeof(tmp), "%s.tmp", j.name);
+      if (!j.pos) {
+        storage.remove(tmp);
+        line_len = 0;
+        used = 0;
+      }
+
+      char buf[CSV_IMPORT_BUFFER];
+      size_t r = storage.read(j.src, j.pos, buf, sizeof(buf));
+      j.pos += r;
+      for (size_t i = 0; i < r; i++) {
+        if (buf[i] == '\n') {
+          parse(tmp);
+          line_len = 0;
+        } else if (line_len < CSV_IMPORT_LINE) {
+          line[line_len++] = buf[i];
+        }
+      }
+
+      // done
+      if (!r) {
+        if (line_len) {
+          parse(tmp);
+        }
+        flush(tmp);
+        // empty archives get an empty file too, so they arent rescanned
+        storage.append(tmp, "", 0);
+        storage.rename(tmp, j.name);
+        jobs_count--;
+        memmove(&jobs[0], &jobs[1], jobs_count * sizeof(Job));
+        if (!jobs_count && rescan) {
+          scan();
+        }
+      }
+
+      if (sched && sched->yield()) {
+        break;
+      }
+    }
+    return jobs_count;
+  }
+
+  // rows imported / lines that didnt parse (header included)
+  unsigned long rows, errors;
+
+private:
+  struct Job {
+    char src[32];
+    char name[32];
+    size_t pos;
+  };
+
+  static void found(const char *name, size_t, time_t, void *arg) {
+    CsvImport *self = (CsvImport *)arg;
+    char bin[32], tmp[32];
+    if ((strlen(name) == 11) && !strcmp(name + 7, ".csv")) {
+      snprintf(bin, sizeof(bin), "%.7s.bin", name);
+      // being written (export, upload): queued when it's renamed in place,
+      // a .bin made now would be stale for good
+      snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+      if (!self->storage.exists(bin) && !self->storage.exists(tmp)) {
+        self->add(name);
+      }
+    }
+  }
+
+  void parse(const char *tmp) {
+    struct tm tm;
+    TH_INFO e;
+    line[(line_len < CSV_IMPORT_LINE) ? line_len : CSV_IMPORT_LINE - 1] = 0;
+    if ((line_len >= CSV_IMPORT_LINE) ||
+        !csv_row_scan(line, tm, e.temperature, e.humidity)) {
+      errors++;
+      return;
+    }
+    e.tempo = mktime(&tm);
+    out[used++] = e;
+    rows++;
+    if (used == CSV_IMPORT_BATCH) {
+      flush(tmp);
+    }
+  }
+
+  void flush(const char *tmp) {
+    if (used) {
+      storage.append(tmp, out, used * sizeof(TH_INFO));
+      used = 0;
+    }
+  }
+
+  Storage &storage;
+  Job jobs[CSV_IMPORT_JOBS];
+  size_t jobs_count;
+  bool rescan;
+  char line[CSV_IMPORT_LINE];
+  size_t line_len;
+  TH_INFO out[CSV_IMPORT_BATCH];
+  size_t used;
+};
+
+#endif
@@ -0,0 +1,31 @@
+/*
+CSV row, as written by CsvExport
+
+"HH:MM:SS, DD-MM-YYYY, t, h" in local time. read back by CsvImport on the
+device and by the PC tools (simulate, lowpower, collector), which each
+turn the time into a time_t their own way.
+*/
+
+#ifndef CSV_ROW_H
+#define CSV_ROW_H
+
+#include <stdio.h>
+#include <time.h>
+
+// tm gets the fields as written (month 0-11, year since 1900), false if s
+// isnt a row (the header)
+inline bool csv_row_scan(const char *s, struct tm &tm, float &temperature,
+                         float &humidity) {
+  tm = {};
+  if (sscanf(s, "%d:%d:%d, %d-%d-%d, %f, %f", &tm.tm_hour, &tm.tm_min,
+             &tm.tm_sec, &tm.tm_mday, &tm.tm_mon, &tm.tm_year, &temperature,
+             &humidity) != 8) {
+    return false;
+  }
+  tm.tm_mon--;
+  tm.tm_year -= 1900;
+  tm.tm_isdst = -1;
+  return true;
+}
+
+#endif
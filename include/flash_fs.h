@@ -0,0 +1,233 @@
+/*
+filesystem mount (ESP8266 only)
+
+with STORAGE_LITTLEFS the data partition is LittleFS. a SPIFFS partition
+left by older firmware is migrated on first boot: every file is staged in
+the free sketch (OTA) space, the partition is formatted as LittleFS and the
+files are written back. the staged copy is only dropped after that, so a
+migration cut by a reset is finished on the next boot. if the files dont
+fit the free sketch space, SPIFFS stays in use.
+
+flash writes/erases of both filesystems are counted for the /bench page
+(needs -Wl,--wrap=flash_hal_write -Wl,--wrap=flash_hal_erase).
+*/
+
+#ifndef FLASH_FS_H
+#define FLASH_FS_H
+
+#include <FS.h>
+#include <LittleFS.h>
+#include <flash_hal.h>
+
+// flash traffic (bytes)
+uint32_t flash_written, flash_erased;
+
+// mounted filesystem
+const char *fs_name = "SPIFFS";
+
+extern "C" {
+int32_t __real_flash_hal_write(uint32_t addr, uint32_t size,
+                               const uint8_t *src);
+int32_t __real_flash_hal_erase(uint32_t addr, uint32_t size);
+
+int32_t __wrap_flash_hal_write(uint32_t addr, uint32_t size,
+                               const uint8_t *src) {
+  flash_written += size;
+  return __real_flash_hal_write(addr, size, src);
+}
+
+int32_t __wrap_flash_hal_erase(uint32_t addr, uint32_t size) {
+  flash_erased += size;
+  return __real_flash_hal_erase(addr, size);
+}
+}
+
+#ifdef STORAGE_LITTLEFS
+
+/*
+staging area: header (written last), then per file a record and its data,
+4 byte aligned
+*/
+
+#define STAGE_MAGIC 0x53464c4dUL
+#define STAGE_HEADER 256
+#define STAGE_NAME 32
+
+struct stage_header {
+  uint32_t magic;
+  uint32_t files;
+};
+
+struct stage_file {
+  uint32_t size;
+  char name[STAGE_NAME];
+};
+
+uint32_t stage_start() {
+  return (ESP.getSketchSize() + FLASH_SECTOR_SIZE - 1) &
+         ~(FLASH_SECTOR_SIZE - 1);
+}
+
+class StageWriter {
+public:
+  StageWriter(uint32_t addr) : addr(addr), erased(addr), fill(0) {}
+
+  bool write(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (len) {
+      size_t n = sizeof(buf) - fill;
+      n = (n < len) ? n : len;
+      memcpy((uint8_t *)buf + fill, p, n);
+      fill += n;
+      p += n;
+      len -= n;
+      if ((fill == sizeof(buf)) && !flush()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // write what's buffered, padded to 4 bytes
+  bool flush() {
+    size_t n = (fill + 3) & ~3;
+    memset((uint8_t *)buf + fill, 0xff, n - fill);
+    if (addr + n > FS_PHYS_ADDR) {
+      return false;
+    }
+    while (erased < addr + n) {
+      if (!ESP.flashEraseSector(erased / FLASH_SECTOR_SIZE)) {
+        return false;
+      }
+      erased += FLASH_SECTOR_SIZE;
+    }
+    if (n && !ESP.flashWrite(addr, buf, n)) {
+      return false;
+    }
+    addr += n;
+    fill = 0;
+    return true;
+  }
+
+private:
+  uint32_t addr, erased;
+  uint32_t buf[64];
+  size_t fill;
+};
+
+// copy every file of fs to the staging area
+bool fs_stage(fs::FS &fs) {
+  uint32_t start = stage_start();
+  // header sector is erased first, so a partial copy is never valid
+  StageWriter w(start);
+  uint32_t header[STAGE_HEADER / 4];
+  memset(header, 0xff, sizeof(header));
+  w.write(header, sizeof(header));
+
+  stage_header h = {STAGE_MAGIC, 0};
+  Dir dir = fs.openDir("/");
+  while (dir.next()) {
+    if (!dir.isFile()) {
+      continue;
+    }
+    stage_file r = {};
+    String n = dir.fileName();
+    snprintf(r.name, sizeof(r.name), "%s%s", n.startsWith("/") ? "" : "/",
+             n.c_str());
+    File f = dir.openFile("r");
+    r.size = f.size();
+    bool ok = w.write(&r, sizeof(r));
+    uint8_t buf[256];
+    int len;
+    while (ok && ((len = f.read(buf, sizeof(buf))) > 0)) {
+      ok = w.write(buf, len);
+    }
+    f.close();
+    if (!ok || !w.flush()) {
+      return false;
+    }
+    h.files++;
+#ifdef DEBUG
+    Serial.println("FS STAGE " + String(r.name));
+#endif
+  }
+
+  memcpy(header, &h, sizeof(h));
+  return ESP.flashWrite(start, header, sizeof(header));
+}
+
+// write staged files back (if there are any) and drop them
+void fs_restore(fs::FS &fs) {
+  uint32_t start = stage_start();
+  stage_header h;
+  if (!ESP.flashRead(start, (uint32_t *)&h, sizeof(h)) ||
+      (h.magic != STAGE_MAGIC)) {
+    return;
+  }
+  uint32_t addr = start + STAGE_HEADER;
+  for (uint32_t i = 0; i < h.files; i++) {
+    stage_file r;
+    ESP.flashRead(addr, (uint32_t *)&r, sizeof(r));
+    addr += sizeof(r);
+    r.name[STAGE_NAME - 1] = 0;
+    File f = fs.open(r.name, "w");
+    uint32_t buf[64];
+    for (uint32_t done = 0; done < r.size; done += sizeof(buf)) {
+      size_t n = r.size - done;
+      n = (n < sizeof(buf)) ? n : sizeof(buf);
+      ESP.flashRead(addr + done, buf, (n + 3) & ~3);
+      f.write((const uint8_t *)buf, n);
+    }
+    f.close();
+    addr += (r.size + 3) & ~3;
+#ifdef DEBUG
+    Serial.println("FS RESTORE " + String(r.name));
+#endif
+  }
+  ESP.flashEraseSector(start / FLASH_SECTOR_SIZE);
+}
+
+// rename() replaces an existing file atomically
+bool fs_rename_replaces(fs::FS &fs) { return &fs == &LittleFS; }
+
+// mount (and migrate), return the filesystem to use
+fs::FS &fs_begin() {
+  // never format on a failed mount, the partition may be the other fs
+  LittleFS.setConfig(LittleFSConfig(false));
+  if (LittleFS.begin()) {
+    fs_restore(LittleFS);
+    fs_name = "LittleFS";
+    return LittleFS;
+  }
+  SPIFFS.setConfig(SPIFFSConfig(false));
+  if (SPIFFS.begin()) {
+#ifdef DEBUG
+    Serial.println("FS MIGRATE");
+#endif
+    if (!fs_stage(SPIFFS)) {
+#ifdef DEBUG
+      Serial.println("FS MIGRATE FAILED, KEEP SPIFFS");
+#endif
+      return SPIFFS;
+    }
+    SPIFFS.end();
+  }
+  LittleFS.format();
+  LittleFS.begin();
+  fs_restore(LittleFS);
+  fs_name = "LittleFS";
+  return LittleFS;
+}
+
+#else
+
+bool fs_rename_replaces(fs::FS &) { return false; }
+
+fs::FS &fs_begin() {
+  SPIFFS.begin();
+  return SPIFFS;
+}
+
+#endif
+
+#endif
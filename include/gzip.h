@@ -0,0 +1,262 @@
+/*
+streaming gzip (deflate) encoder
+
+small window LZ77 (GZIP_WINDOW bytes back, hash chains GZIP_CHAIN deep,
+greedy) coded with the fixed huffman tables, so there are no tables to
+build or send. about 5.7 KB of RAM (sizeof(Gzip), tools/gzbench prints it)
+while a response is being compressed. the cost on the device is on the
+/bench page.
+
+output goes out GZIP_OUT bytes at a time through the callback; nothing is
+output before the first write(), so headers can still be sent after the
+encoder is created.
+*/
+
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+
+typedef void (*gzip_fn)(const uint8_t *data, size_t len, void *arg);
+
+// match distance limit (power of 2), the buffer is twice that
+#define GZIP_WINDOW 1024
+#define GZIP_HASH_BITS 9
+#define GZIP_CHAIN 8
+#define GZIP_OUT 512
+
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+
+class Gzip {
+public:
+  Gzip(gzip_fn out, void *arg)
+      : out(out), arg(arg), fill(0), pos(0), bits(0), nbits(0), used(0),
+        crc(0xffffffff), total_in(0), total_out(0) {
+    memset(head, 0, sizeof(head));
+    memset(prev, 0, sizeof(prev));
+    // magic, deflate, no flags/mtime, unknown os
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    for (uint8_t b : header) {
+      put_byte(b);
+    }
+    // one fixed huffman block for the whole stream
+    put_bits(2, 3);
+  }
+
+  void write(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = crc32_update(crc, p, len);
+    total_in += len;
+    while (len) {
+      if (fill == sizeof(win)) {
+        compress(false);
+        slide();
+      }
+      size_t n = sizeof(win) - fill;
+      n = (n < len) ? n : len;
+      memcpy(win + fill, p, n);
+      fill += n;
+      p += n;
+      len -= n;
+    }
+  }
+
+  void finish() {
+    compress(true);
+    put_symbol(256);
+    // empty final block
+    put_bits(3, 3);
+    put_symbol(256);
+    if (nbits) {
+      put_bits(0, 8 - nbits);
+    }
+    crc = ~crc;
+    for (int i = 0; i < 4; i++) {
+      put_byte(crc >> (8 * i));
+    }
+    for (int i = 0; i < 4; i++) {
+      put_byte(total_in >> (8 * i));
+    }
+    flush();
+  }
+
+  uint32_t bytes_in() const { return total_in; }
+  uint32_t bytes_out() const { return total_out + used; }
+
+private:
+  /*
+  lz77
+  */
+
+  uint16_t hash(size_t p) const {
+    uint32_t v = (win[p] << 16) | (win[p + 1] << 8) | win[p + 2];
+    return (v * 2654435761u) >> (32 - GZIP_HASH_BITS);
+  }
+
+  // positions are kept +1, 0 is empty
+  void insert(size_t p) {
+    uint16_t h = hash(p);
+    prev[p & (GZIP_WINDOW - 1)] = head[h];
+    head[h] = p + 1;
+  }
+
+  void compress(bool all) {
+    while ((pos < fill) && (all || (fill - pos > GZIP_MAX_MATCH))) {
+      size_t avail = fill - pos;
+      size_t best = 0, dist = 0;
+      if (avail >= GZIP_MIN_MATCH) {
+        size_t limit = (avail < GZIP_MAX_MATCH) ? avail : GZIP_MAX_MATCH;
+        int chain = GZIP_CHAIN;
+        for (uint16_t c = head[hash(pos)]; c && chain--;
+             c = prev[(c - 1) & (GZIP_WINDOW - 1)]) {
+          size_t cand = c - 1;
+          if (pos - cand >= GZIP_WINDOW) {
+            break;
+          }
+          if (win[cand + best] != win[pos + best]) {
+            continue;
+          }
+          size_t l = 0;
+          while ((l < limit) && (win[cand + l] == win[pos + l])) {
+            l++;
+          }
+          if (l > best) {
+            best = l;
+            dist = pos - cand;
+            if (l == limit) {
+              break;
+            }
+          }
+        }
+        insert(pos);
+      }
+
+      if (best >= GZIP_MIN_MATCH) {
+        put_match(best, dist);
+        for (size_t p = pos + 1; (p < pos + best) && (p + 2 < fill); p++) {
+          insert(p);
+        }
+        pos += best;
+      } else {
+        put_symbol(win[pos]);
+        pos++;
+      }
+    }
+  }
+
+  // drop the oldest half of the buffer
+  void slide() {
+    memmove(win, win + GZIP_WINDOW, fill - GZIP_WINDOW);
+    fill -= GZIP_WINDOW;
+    pos -= GZIP_WINDOW;
+    for (auto &h : head) {
+      h = (h > GZIP_WINDOW) ? h - GZIP_WINDOW : 0;
+    }
+    for (auto &p : prev) {
+      p = (p > GZIP_WINDOW) ? p - GZIP_WINDOW : 0;
+    }
+  }
+
+  /*
+  fixed huffman codes
+  */
+
+  void put_match(size_t len, size_t dist) {
+    static const uint16_t lbase[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                       11, 13, 15, 17,  19,  23,  27,  31,
+                                       35, 43, 51, 59,  67,  83,  99,  115,
+                                       131, 163, 195, 227, 258};
+    static const uint16_t dbase[30] = {
+        1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+    int l = 28;
+    while (lbase[l] > len) {
+      l--;
+    }
+    put_symbol(257 + l);
+    if ((l >= 8) && (l < 28)) {
+      put_bits(len - lbase[l], (l - 4) / 4);
+    }
+    int d = 29;
+    while (dbase[d] > dist) {
+      d--;
+    }
+    put_bits(reverse(d, 5), 5);
+    if (d >= 4) {
+      put_bits(dist - dbase[d], (d - 2) / 2);
+    }
+  }
+
+  // literal/length symbol
+  void put_symbol(unsigned int s) {
+    if (s < 144) {
+      put_bits(reverse(0x30 + s, 8), 8);
+    } else if (s < 256) {
+      put_bits(reverse(0x190 + s - 144, 9), 9);
+    } else if (s < 280) {
+      put_bits(reverse(s - 256, 7), 7);
+    } else {
+      put_bits(reverse(0xc0 + s - 280, 8), 8);
+    }
+  }
+
+  static uint32_t reverse(uint32_t code, int len) {
+    uint32_t r = 0;
+    while (len--) {
+      r = (r << 1) | (code & 1);
+      code >>= 1;
+    }
+    return r;
+  }
+
+  /*
+  output
+  */
+
+  void put_bits(uint32_t value, int len) {
+    bits |= value << nbits;
+    nbits += len;
+    while (nbits >= 8) {
+      put_byte(bits);
+      bits >>= 8;
+      nbits -= 8;
+    }
+  }
+
+  void put_byte(uint8_t b) {
+    buf[used++] = b;
+    if (used == sizeof(buf)) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (used) {
+      out(buf, used, arg);
+      total_out += used;
+      used = 0;
+    }
+  }
+
+  gzip_fn out;
+  void *arg;
+
+  uint8_t win[2 * GZIP_WINDOW];
+  size_t fill, pos;
+  uint16_t head[1 << GZIP_HASH_BITS];
+  uint16_t prev[GZIP_WINDOW];
+
+  uint32_t bits;
+  int nbits;
+  uint8_t buf[GZIP_OUT];
+  size_t used;
+
+  uint32_t crc, total_in, total_out;
+};
+
+#endif
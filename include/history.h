@@ -0,0 +1,132 @@
+/*
+temperature/humidity history
+
+entries live in a flash file, only a few pages of it are kept in RAM (LRU).
+history size is limited by flash, not by RAM.
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <time.h>
+
+#include "storage.h"
+
+struct TH_INFO {
+  time_t tempo;
+  float temperature;
+  float humidity;
+};
+
+// entries per page / pages in RAM
+#define HISTORY_PAGE_ENTRIES 16
+#define HISTORY_CACHE_PAGES 4
+
+class History {
+public:
+  History(Storage &storage, const char *path)
+      : storage(storage), path(path), entries(0), tick(0) {
+    invalidate();
+  }
+
+  // read file size
+  void begin() {
+    entries = storage.size(path) / sizeof(TH_INFO);
+    invalidate();
+  }
+
+  unsigned int count() const { return entries; }
+
+  // pointer valid till next history call
+  const TH_INFO *at(unsigned int index) {
+    if (index >= entries) {
+      return nullptr;
+    }
+    Page *p = load(index / HISTORY_PAGE_ENTRIES);
+    unsigned int i = index % HISTORY_PAGE_ENTRIES;
+    return (p && (i < p->used)) ? &p->entry[i] : nullptr;
+  }
+
+  const TH_INFO *last() { return entries ? at(entries - 1) : nullptr; }
+
+  bool append(const TH_INFO &e) {
+    if (storage.append(path, &e, sizeof(TH_INFO)) != sizeof(TH_INFO)) {
+      return false;
+    }
+    // keep cached page in sync
+    Page *p = find(entries / HISTORY_PAGE_ENTRIES);
+    if (p) {
+      p->entry[p->used++] = e;
+    }
+    entries++;
+    return true;
+  }
+
+  // erase everything, optionally keeping one entry
+  void reset(const TH_INFO *keep = nullptr) {
+    TH_INFO e;
+    if (keep) {
+      e = *keep;
+    }
+    storage.remove(path);
+    entries = 0;
+    invalidate();
+    if (keep) {
+      append(e);
+    }
+  }
+
+private:
+  struct Page {
+    int number;
+    unsigned int used;
+    unsigned long lru;
+    TH_INFO entry[HISTORY_PAGE_ENTRIES];
+  };
+
+  void invalidate() {
+    for (int i = 0; i < HISTORY_CACHE_PAGES; i++) {
+      pages[i].number = -1;
+      pages[i].used = 0;
+      pages[i].lru = 0;
+    }
+  }
+
+  Page *find(int number) {
+    for (int i = 0; i < HISTORY_CACHE_PAGES; i++) {
+      if (pages[i].number == number) {
+        pages[i].lru = ++tick;
+        return &pages[i];
+      }
+    }
+    return nullptr;
+  }
+
+  Page *load(int number) {
+    Page *p = find(number);
+    if (p) {
+      return p;
+    }
+    // evict least recently used
+    p = &pages[0];
+    for (int i = 1; i < HISTORY_CACHE_PAGES; i++) {
+      if (pages[i].lru < p->lru) {
+        p = &pages[i];
+      }
+    }
+    size_t r = storage.read(path, number * sizeof(p->entry), p->entry,
+                            sizeof(p->entry));
+    p->number = number;
+    p->used = r / sizeof(TH_INFO);
+    p->lru = ++tick;
+    return p;
+  }
+
+  Storage &storage;
+  const char *path;
+  unsigned int entries;
+  unsigned long tick;
+  Page pages[HISTORY_CACHE_PAGES];
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*
+hourly logger
+
+appends one sample per hour to the history, exports daily/monthly CSVs and
+starts a new history on month change. time is passed in, so it can be
+driven by a virtual clock (tools/simulate.cpp, tools/lowpower.cpp)
+*/
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <time.h>
+
+#include "csv_export.h"
+#include "history.h"
+#include "storage.h"
+
+#if defined(DEBUG) && defined(ARDUINO)
+#define LOGGER_DEBUG(X) Serial.println(X)
+#else
+#define LOGGER_DEBUG(X)
+#endif
+
+// read temperature and humidity
+typedef void (*sensor_fn)(float &temperature, float &humidity);
+
+class Logger {
+public:
+  Logger(Storage &storage, History &history, CsvExport &csv_export,
+         sensor_fn sensor)
+      : current(0), storage(storage), history(history),
+        csv_export(csv_export), sensor(sensor) {}
+
+  // history must be loaded
+  void begin(time_t t) {
+    current = t;
+    // get last read time from cache
+    const TH_INFO *last = history.last();
+    if (last) {
+      current = last->tempo;
+    }
+    // last month export didnt finish
+    export_month("/MONTH");
+  }
+
+  // true if a sample was logged
+  bool tick(time_t t) {
+    struct tm now, last;
+    // get date/time now
+    localtime_r(&t, &now);
+    // get last update date
+    localtime_r(&current, &last);
+
+    // check if hour changed
+    if (now.tm_hour == last.tm_hour) {
+      return false;
+    }
+
+    // log temperatura and humidity
+    TH_INFO e;
+    e.tempo = t;
+    sensor(e.temperature, e.humidity);
+    store(e);
+    return true;
+  }
+
+  // log a sample taken now or earlier (buffered in low power mode), entries
+  // must come in time order
+  void store(const TH_INFO &e) {
+    struct tm now, last, yesterday;
+    localtime_r(&e.tempo, &now);
+    localtime_r(&current, &last);
+    current = e.tempo;
+
+    // get yesterday date (for filenames porpouse)
+    yesterday = now;
+    yesterday.tm_mday--;
+    mktime(&yesterday);
+
+    // append to binary cache
+    history.append(e);
+    LOGGER_DEBUG("SAVE H");
+
+    // exports read from here
+    const char *src = "/CACHE";
+    unsigned int n = history.count();
+
+    // check if month changed
+    bool new_month = now.tm_mon != last.tm_mon;
+    if (new_month) {
+      // keep last month apart till it's exported
+      storage.rename("/CACHE", "/MONTH");
+      src = "/MONTH";
+      // reset data (move last entry to first)
+      history.reset(&e);
+    }
+
+#ifdef DAILY_FILE
+    //  check if day changed
+    if (now.tm_mday != last.tm_mday) {
+      // gera nome do arquivo
+      char buf[32];
+      strftime(buf, sizeof(buf), "/%d%m%Y.csv", &yesterday);
+      // write arquivo diario
+      csv_export.add(src, (n < 24) ? 0 : (n - 25), n - 1, buf, false);
+      LOGGER_DEBUG("SAVE D");
+    }
+#else
+    (void)n;
+    (void)yesterday;
+#endif
+
+    if (new_month) {
+      // write arquivo mensal
+      export_month(src);
+      LOGGER_DEBUG("SAVE M");
+    }
+  }
+
+  // time of last sample
+  time_t current;
+
+private:
+  // queue (interrupted) monthly export of src, removed when done
+  void export_month(const char *src) {
+    char buf[32];
+    TH_INFO e;
+    unsigned int n = storage.size(src) / sizeof(TH_INFO);
+    if ((n < 2) ||
+        !storage.read(src, (n - 2) * sizeof(TH_INFO), &e, sizeof(TH_INFO))) {
+      storage.remove(src);
+      return;
+    }
+    strftime(buf, sizeof(buf), "/%m%Y.csv", localtime(&e.tempo));
+    csv_export.add(src, 0, n - 1, buf, true);
+  }
+
+  Storage &storage;
+  History &history;
+  CsvExport &csv_export;
+  sensor_fn sensor;
+};
+
+#endif
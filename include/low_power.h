@@ -0,0 +1,216 @@
+/*
+low power (duty cycled) mode
+
+the ESP deep sleeps between samples. readings are kept in RTC user memory,
+which survives deep sleep (not power loss) and is checked by a CRC. only
+every `batch` samples the radio is woken to write them to flash and publish
+them; other wakes just read the sensor, with the radio off.
+
+time between NTP syncs is kept by counting sleep periods. the sleep timer
+drifts: on each sync the error is spread over the buffered samples and the
+timer is calibrated. a batch is only flushed without a sync once the timer
+is calibrated (or the buffer is full), so its times stay close. batch is at
+most half the buffer: after a power cut the timer is uncalibrated, the
+headroom lets failed connects retry before the buffer fills.
+samples are taken on the period grid (top of the hour). a batch is
+published before it is flushed: a month change on flush moves older entries
+out of the history. pure logic, the sleeping and sending is done by main.cpp
+(tools/lowpower.cpp on a PC).
+*/
+
+#ifndef LOW_POWER_H
+#define LOW_POWER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+#include "history.h"
+
+#define LOW_POWER_SAMPLES 24
+#define LOW_POWER_MAGIC 0x4c4f5750UL
+// calibration limit (ppm)
+#define LOW_POWER_DRIFT 100000
+
+// RTC user memory image (512 bytes, 4 byte words)
+struct rtc_data {
+  uint32_t crc;
+  uint32_t magic;
+  time_t clock;          // next sample, 0 if time is unknown
+  time_t synced;         // last NTP sync, 0 if never
+  uint32_t count;        // buffered samples
+  uint32_t unpublished;  // in flash, not on MQTT yet
+  uint32_t wakes, flushes, calibrations;
+  int32_t drift;         // sleep timer error, ppm
+  TH_INFO sample[LOW_POWER_SAMPLES];
+};
+
+static_assert((sizeof(rtc_data) <= 512) && !(sizeof(rtc_data) % 4),
+              "rtc_data doesnt fit RTC user memory");
+
+// save a buffered sample
+typedef void (*store_fn)(const TH_INFO &e, void *arg);
+// send a sample, false if it failed
+typedef bool (*publish_fn)(const TH_INFO &e, void *arg);
+
+class LowPower {
+public:
+  LowPower(rtc_data &rtc, unsigned int batch, unsigned long period)
+      : rtc(rtc), skipped(0),
+        batch((batch < 1)                       ? 1
+              : (batch > LOW_POWER_SAMPLES / 2) ? LOW_POWER_SAMPLES / 2
+                                                : batch),
+        period(period), wake(0), wake_ms(0), sent(0), ntp(false) {}
+
+  // rtc was just read, woke: reset was a deep sleep wake.
+  // false if the buffer was lost (power on)
+  bool begin(bool woke) {
+    wake_ms = 0;
+    sent = 0;
+    skipped = 0;
+    ntp = false;
+    if (!woke || (rtc.magic != LOW_POWER_MAGIC) || (rtc.crc != crc())) {
+      memset(&rtc, 0, sizeof(rtc));
+      rtc.magic = LOW_POWER_MAGIC;
+      wake = 0;
+      return false;
+    }
+    rtc.wakes++;
+    // scheduled time of this wake
+    wake = rtc.clock;
+    return true;
+  }
+
+  // this wake (or the next one, after add) needs the radio: no time yet,
+  // or the batch is full
+  bool radio() const { return !rtc.synced || (rtc.count + 1u >= batch); }
+
+  // time t from NTP, ms after wake
+  void sync(time_t t, unsigned long ms) {
+    time_t real = t - (time_t)(ms / 1000);
+    // estimated clock ran from the last sync, spread its error
+    if (rtc.synced && (wake > rtc.synced)) {
+      long long span = wake - rtc.synced;
+      long long error = real - wake;
+      for (unsigned int i = 0; i < rtc.count; i++) {
+        time_t &s = rtc.sample[i].tempo;
+        s += (time_t)(error * (s - rtc.synced) / span);
+      }
+      // what's left after the last calibration (seconds are too coarse
+      // for short spans)
+      if (span >= (long long)period) {
+        long long d = rtc.drift + error * 1000000 / span;
+        rtc.drift = (d > LOW_POWER_DRIFT)    ? LOW_POWER_DRIFT
+                    : (d < -LOW_POWER_DRIFT) ? -LOW_POWER_DRIFT
+                                             : d;
+        rtc.calibrations++;
+      }
+    }
+    wake = real;
+    wake_ms = (ms / 1000) * 1000;
+    ntp = true;
+    rtc.synced = real;
+    if (!rtc.clock) {
+      rtc.clock = real;
+    }
+  }
+
+  // buffer a reading taken at this wake (time must be known)
+  void add(float temperature, float humidity) {
+    if (!rtc.clock || (rtc.count >= LOW_POWER_SAMPLES)) {
+      return;
+    }
+    rtc.sample[rtc.count++] = TH_INFO{wake, temperature, humidity};
+    // next grid point, at least half a period away
+    time_t next = (wake / period + 1) * period;
+    if ((unsigned long)(next - wake) < period / 2) {
+      next += period;
+    }
+    rtc.clock = next;
+  }
+
+  // batch is due for flash
+  bool full() const {
+    return (rtc.count >= batch) && (ntp || rtc.calibrations ||
+                                    (rtc.count >= LOW_POWER_SAMPLES));
+  }
+
+  // send what's in flash but not published yet (history must be loaded),
+  // then the buffered samples, oldest first, till one fails. call right
+  // before flush. returns how many were sent
+  unsigned int publish(History &history, publish_fn send, void *arg) {
+    unsigned int n = history.count();
+    unsigned int done = 0;
+    // month changed while offline, older ones are in a monthly CSV now
+    skipped = (rtc.unpublished > n) ? rtc.unpublished - n : 0;
+    unsigned int i = n - (rtc.unpublished - skipped);
+    for (; i < n; i++) {
+      const TH_INFO *e = history.at(i);
+      if (!e || !send(*e, arg)) {
+        break;
+      }
+      done++;
+    }
+    rtc.unpublished = n - i;
+    // keep the order, buffer goes after the backlog
+    for (sent = 0; !rtc.unpublished && (sent < rtc.count); sent++) {
+      if (!send(rtc.sample[sent], arg)) {
+        break;
+      }
+      done++;
+    }
+    return done;
+  }
+
+  // save buffered samples (oldest first), returns how many
+  unsigned int flush(store_fn store, void *arg) {
+    unsigned int n = rtc.count;
+    for (unsigned int i = 0; i < n; i++) {
+      store(rtc.sample[i], arg);
+    }
+    rtc.count = 0;
+    rtc.unpublished += n - sent;
+    sent = 0;
+    rtc.flushes++;
+    return n;
+  }
+
+  // us till next sample, ms: time awake
+  uint64_t sleep_us(unsigned long ms) const {
+    if (!rtc.clock) {
+      return period * 1000000ULL;
+    }
+    long long us = (long long)(rtc.clock - wake) * 1000000 -
+                   (long long)(ms - wake_ms) * 1000;
+    // timer runs drift ppm slow
+    us = us * 1000000 / (1000000 + rtc.drift);
+    return (us < 1000000) ? 1000000 : us;
+  }
+
+  // before writing to RTC memory
+  void seal() { rtc.crc = crc(); }
+
+  rtc_data &rtc;
+  // unpublished, but no longer in the history (on last publish)
+  unsigned int skipped;
+
+private:
+  // crc32 of everything after the crc
+  uint32_t crc() const {
+    return ~crc32_update(0xffffffff, (const uint8_t *)&rtc + sizeof(rtc.crc),
+                         sizeof(rtc) - sizeof(rtc.crc));
+  }
+
+  unsigned int batch;
+  unsigned long period;
+  // (estimated) time of this wake, at wake_ms
+  time_t wake;
+  unsigned long wake_ms;
+  // buffered samples published on this wake
+  unsigned int sent;
+  // clock set by NTP on this wake
+  bool ntp;
+};
+
+#endif
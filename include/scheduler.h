@@ -0,0 +1,113 @@
+/*
+cooperative scheduler
+
+each task has a period, a priority and a time budget per slice. long jobs
+check yield() and return true to be called again on the next loop.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define sched_millis millis
+#define sched_micros micros
+#else
+// provided by the host program
+unsigned long sched_millis();
+unsigned long sched_micros();
+#endif
+
+// return true if there's more work to do (run again asap)
+typedef bool (*task_fn)();
+
+struct Task {
+  const char *name;
+  unsigned long period; // ms between runs
+  unsigned char priority; // higher runs first
+  unsigned long budget; // us per slice
+  task_fn fn;
+
+  // state
+  unsigned long last;
+  bool pending;
+
+  // stats
+  unsigned long runs;
+  unsigned long overruns;
+  unsigned long max_us;
+  unsigned long long total_us;
+};
+
+#define TASK(NAME, PERIOD, PRIORITY, BUDGET, FN)                               \
+  { NAME, PERIOD, PRIORITY, BUDGET, FN, 0, false, 0, 0, 0, 0 }
+
+class Scheduler {
+public:
+  Scheduler(Task *tasks, size_t count)
+      : tasks(tasks), count(count), current(nullptr), slice_start(0),
+        loops(0), loop_us(0) {
+    // sort by priority (insertion sort, few tasks)
+    for (size_t i = 1; i < count; i++) {
+      Task t = tasks[i];
+      size_t j = i;
+      while (j && tasks[j - 1].priority < t.priority) {
+        tasks[j] = tasks[j - 1];
+        j--;
+      }
+      tasks[j] = t;
+    }
+  }
+
+  // one pass, run every due task
+  void run() {
+    unsigned long loop_start = sched_micros();
+    for (size_t i = 0; i < count; i++) {
+      Task &t = tasks[i];
+      unsigned long now = sched_millis();
+      if (!t.pending && (now - t.last) < t.period) {
+        continue;
+      }
+      if (!t.pending) {
+        t.last = now;
+      }
+      current = &t;
+      slice_start = sched_micros();
+      t.pending = t.fn();
+      unsigned long us = sched_micros() - slice_start;
+      current = nullptr;
+      t.runs++;
+      t.total_us += us;
+      if (us > t.max_us) {
+        t.max_us = us;
+      }
+      if (us > t.budget) {
+        t.overruns++;
+      }
+    }
+    loops++;
+    loop_us += sched_micros() - loop_start;
+  }
+
+  // inside a task: slice budget is over, save state and return true
+  bool yield() const {
+    return current && ((sched_micros() - slice_start) >= current->budget);
+  }
+
+  size_t size() const { return count; }
+  const Task &task(size_t i) const { return tasks[i]; }
+  unsigned long loop_count() const { return loops; }
+  unsigned long long loop_time() const { return loop_us; }
+
+private:
+  Task *tasks;
+  size_t count;
+  Task *current;
+  unsigned long slice_start;
+  unsigned long loops;
+  unsigned long long loop_us;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*
+storage backend
+
+small file interface used by the history/log/www code, so it doesnt depend
+on SPIFFS/LittleFS directly (and can run on a PC). names always start with
+"/".
+*/
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// file found by list()
+typedef void (*list_fn)(const char *name, size_t size, time_t time, void *arg);
+// chunk read by stream()
+typedef void (*chunk_fn)(const uint8_t *data, size_t len, void *arg);
+
+class Storage {
+public:
+  virtual ~Storage() {}
+  virtual bool exists(const char *path) = 0;
+  // file size (0 if it doesnt exist)
+  virtual size_t size(const char *path) = 0;
+  // read len bytes starting at offset, return bytes read
+  virtual size_t read(const char *path, size_t offset, void *buf,
+                      size_t len) = 0;
+  // append to end of file (create if needed), return bytes written
+  virtual size_t append(const char *path, const void *buf, size_t len) = 0;
+  virtual bool remove(const char *path) = 0;
+  virtual bool rename(const char *from, const char *to) = 0;
+  // call f for every file
+  virtual void list(list_fn f, void *arg) = 0;
+  // read whole file through buf, call f for each chunk, return bytes read
+  virtual size_t stream(const char *path, void *buf, size_t len, chunk_fn f,
+                        void *arg) = 0;
+  // filesystem size and usage (bytes)
+  virtual bool info(size_t &total, size_t &used) = 0;
+};
+
+#ifdef ARDUINO
+#include <FS.h>
+
+// SPIFFS/LittleFS
+class FSStorage : public Storage {
+public:
+  FSStorage(fs::FS &fs) : fs(&fs), replaces(false) {}
+
+  // switch filesystem (after mount/migration), r: its rename replaces an
+  // existing file atomically (LittleFS)
+  void use(fs::FS &f, bool r) {
+    fs = &f;
+    replaces = r;
+  }
+
+  bool exists(const char *path) { return fs->exists(path); }
+
+  size_t size(const char *path) {
+    if (!fs->exists(path)) {
+      return 0;
+    }
+    File f = fs->open(path, "r");
+    size_t s = f ? f.size() : 0;
+    f.close();
+    return s;
+  }
+
+  size_t read(const char *path, size_t offset, void *buf, size_t len) {
+    if (!fs->exists(path)) {
+      return 0;
+    }
+    File f = fs->open(path, "r");
+    size_t r = 0;
+    if (f && f.seek(offset, SeekSet)) {
+      r = f.read((uint8_t *)buf, len);
+    }
+    f.close();
+    return r;
+  }
+
+  size_t append(const char *path, const void *buf, size_t len) {
+    File f = fs->open(path, "a");
+    size_t w = f ? f.write((const uint8_t *)buf, len) : 0;
+    f.close();
+    return w;
+  }
+
+  bool remove(const char *path) { return fs->remove(path); }
+
+  bool rename(const char *from, const char *to) {
+    // SPIFFS wont overwrite (a reset in between leaves no "to")
+    if (!replaces) {
+      fs->remove(to);
+    }
+    return fs->rename(from, to);
+  }
+
+  void list(list_fn f, void *arg) {
+    Dir dir = fs->openDir("/");
+    char name[33];
+    while (dir.next()) {
+      if (dir.isFile()) {
+        // LittleFS names come without the "/"
+        String n = dir.fileName();
+        snprintf(name, sizeof(name), "%s%s", n.startsWith("/") ? "" : "/",
+                 n.c_str());
+        f(name, dir.fileSize(), dir.fileTime(), arg);
+      }
+    }
+  }
+
+  size_t stream(const char *path, void *buf, size_t len, chunk_fn f,
+                void *arg) {
+    if (!fs->exists(path)) {
+      return 0;
+    }
+    File file = fs->open(path, "r");
+    size_t total = 0;
+    int r;
+    while (file && ((r = file.read((uint8_t *)buf, len)) > 0)) {
+      f((const uint8_t *)buf, r, arg);
+      total += r;
+    }
+    file.close();
+    return total;
+  }
+
+  bool info(size_t &total, size_t &used) {
+    FSInfo i;
+    if (!fs->info(i)) {
+      return false;
+    }
+    total = i.totalBytes;
+    used = i.usedBytes;
+    return true;
+  }
+
+private:
+  fs::FS *fs;
+  bool replaces;
+};
+#endif
+
+#endif
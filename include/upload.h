@@ -0,0 +1,237 @@
+/*
+file upload into storage
+
+data is gathered into UPLOAD_BLOCK byte blocks (whole flash pages) before
+it is appended, so the filesystem sees a few big writes instead of one per
+network chunk. it goes to "<name>.uptmp", renamed to "<name>.upnew" when
+the upload completes, then over <name>. a cut upload never leaves a
+partial file: cleanup() drops .uptmp files and finishes the rename of
+.upnew ones (on SPIFFS replacing <name> is a remove plus a rename). the
+suffixes are the uploader's own, other files are never touched. uploads
+that wont fit are refused before anything is written.
+*/
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage.h"
+
+#define UPLOAD_BLOCK 4096
+// left free for the logger
+#define UPLOAD_RESERVE 16384
+#define UPLOAD_NAME 32
+#define UPLOAD_TMP ".uptmp"
+// complete, not renamed yet (same length as UPLOAD_TMP)
+#define UPLOAD_NEW ".upnew"
+
+enum upload_result {
+  UPLOAD_IDLE,
+  UPLOAD_RUNNING,
+  UPLOAD_DONE,
+  UPLOAD_NO_SPACE,
+  UPLOAD_BAD_NAME,
+  UPLOAD_NO_MEMORY,
+  UPLOAD_WRITE_ERROR,
+  UPLOAD_ABORTED
+};
+
+class Upload {
+public:
+  Upload(Storage &storage)
+      : result(UPLOAD_IDLE), bytes(0), ms(0), storage(storage),
+        block(nullptr), used(0), expected(0), start(0) {
+    name[0] = tmp[0] = 0;
+  }
+
+  ~Upload() { free(block); }
+
+  // size: expected bytes (0 if unknown), now: ms clock
+  bool begin(const char *path, size_t size, unsigned long now) {
+    abort();
+    bytes = 0;
+    ms = 0;
+    start = now;
+    expected = size;
+    name[0] = tmp[0] = 0;
+    if (!*path || (strlen(path) + strlen(UPLOAD_TMP) >= UPLOAD_NAME)) {
+      return fail(UPLOAD_BAD_NAME);
+    }
+    strcpy(name, path);
+    snprintf(tmp, sizeof(tmp), "%s" UPLOAD_TMP, path);
+    if (!fits(size)) {
+      return fail(UPLOAD_NO_SPACE);
+    }
+    if (!block && !(block = (uint8_t *)malloc(UPLOAD_BLOCK))) {
+      return fail(UPLOAD_NO_MEMORY);
+    }
+    storage.remove(tmp);
+    result = UPLOAD_RUNNING;
+    return true;
+  }
+
+  bool write(const void *data, size_t len) {
+    if (result != UPLOAD_RUNNING) {
+      return false;
+    }
+    const uint8_t *p = (const uint8_t *)data;
+    while (len) {
+      size_t n = UPLOAD_BLOCK - used;
+      n = (n < len) ? n : len;
+      memcpy(block + used, p, n);
+      used += n;
+      p += n;
+      len -= n;
+      if ((used == UPLOAD_BLOCK) && !flush()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // commit the file
+  bool end(unsigned long now) {
+    if ((result != UPLOAD_RUNNING) || !flush()) {
+      return false;
+    }
+    // tmp with the suffix swapped, fits the same buffer
+    char fresh[UPLOAD_NAME];
+    strcpy(fresh, tmp);
+    strcpy(fresh + strlen(fresh) - strlen(UPLOAD_TMP), UPLOAD_NEW);
+    if (!storage.rename(tmp, fresh)) {
+      return fail(UPLOAD_WRITE_ERROR);
+    }
+    // from here a reset is finished by cleanup()
+    if (!storage.rename(fresh, name)) {
+      storage.remove(fresh);
+      return fail(UPLOAD_WRITE_ERROR);
+    }
+    ms = now - start;
+    release();
+    result = UPLOAD_DONE;
+    return true;
+  }
+
+  void abort() {
+    if (result == UPLOAD_RUNNING) {
+      fail(UPLOAD_ABORTED);
+    }
+  }
+
+  // KB/s of the last upload
+  float rate() const { return ms ? (float)bytes / ms * 1000 / 1024 : 0; }
+
+  const char *message() const {
+    static const char *m[] = {"",
+                              "Uploading",
+                              "Uploaded",
+                              "Not enough space",
+                              "Bad file name",
+                              "Out of memory",
+                              "Write error",
+                              "Upload aborted"};
+    return m[result];
+  }
+
+  const char *file() const { return name; }
+
+  // after a reset: remove partial (.uptmp) files, put complete (.upnew)
+  // ones in place. one try per file found (a failed remove would be found
+  // again)
+  void cleanup() {
+    Found f = {0, {0}};
+    storage.list(find_tmp, &f);
+    for (unsigned int n = f.count; n; n--) {
+      f.path[0] = 0;
+      storage.list(find_tmp, &f);
+      size_t len = strlen(f.path);
+      if (!len) {
+        break;
+      }
+      if (!strcmp(f.path + len - strlen(UPLOAD_NEW), UPLOAD_NEW)) {
+        char to[UPLOAD_NAME];
+        snprintf(to, sizeof(to), "%.*s", (int)(len - strlen(UPLOAD_NEW)),
+                 f.path);
+        if (storage.rename(f.path, to)) {
+          continue;
+        }
+      }
+      storage.remove(f.path);
+    }
+  }
+
+  upload_result result;
+  size_t bytes;
+  unsigned long ms;
+
+private:
+  bool fits(size_t size) {
+    size_t total, used_bytes;
+    if (!storage.info(total, used_bytes)) {
+      return true;
+    }
+    // the old file is only removed after the new one is written
+    size_t free_bytes = (total > used_bytes) ? total - used_bytes : 0;
+    return size + UPLOAD_RESERVE <= free_bytes;
+  }
+
+  bool flush() {
+    if (!used) {
+      return true;
+    }
+    // size wasnt checked up front
+    if (!expected && !fits(used)) {
+      return fail(UPLOAD_NO_SPACE);
+    }
+    if (storage.append(tmp, block, used) != used) {
+      return fail(UPLOAD_WRITE_ERROR);
+    }
+    bytes += used;
+    used = 0;
+    return true;
+  }
+
+  struct Found {
+    unsigned int count;
+    char path[UPLOAD_NAME];
+  };
+
+  // counts the uploader's files, keeps the last one
+  static void find_tmp(const char *path, size_t, time_t, void *arg) {
+    Found *f = (Found *)arg;
+    size_t len = strlen(path);
+    if ((len > strlen(UPLOAD_TMP)) && (len < UPLOAD_NAME) &&
+        (!strcmp(path + len - strlen(UPLOAD_TMP), UPLOAD_TMP) ||
+         !strcmp(path + len - strlen(UPLOAD_NEW), UPLOAD_NEW))) {
+      f->count++;
+      strcpy(f->path, path);
+    }
+  }
+
+  // drop the temp file
+  bool fail(upload_result r) {
+    if (tmp[0]) {
+      storage.remove(tmp);
+    }
+    release();
+    result = r;
+    return false;
+  }
+
+  void release() {
+    free(block);
+    block = nullptr;
+    used = 0;
+  }
+
+  Storage &storage;
+  char name[UPLOAD_NAME], tmp[UPLOAD_NAME];
+  uint8_t *block;
+  size_t used, expected;
+  unsigned long start;
+};
+
+#endif
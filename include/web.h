@@ -0,0 +1,511 @@
+/*
+www pages
+
+main page, graph data, imported months, raw data, file manager and SSDP
+description. included by main.cpp (and by tools/loadtest.cpp on a PC), uses
+its server, storage, history, temperature/humidity and get_sensors()
+*/
+
+#ifndef WEB_H
+#define WEB_H
+
+#include <new>
+
+#include "gzip.h"
+#include "version.h"
+
+const char html_header[] PROGMEM = R""""(<!DOCTYPE html>
+<html lang='pt-br'>
+<head>
+<meta charset='UTF-8'>
+<meta name='viewport' content='width=device-width, initial-scale=1'>
+<meta http-equiv='cache-control' content='no-cache, no-store, must-revalidate'>
+<meta http-equiv='refresh' content='600; url=/'>
+<script src='https://cdn.jsdelivr.net/npm/chart.js'></script>
+<link rel='stylesheet' href='https://cdn.simplecss.org/simple.min.css'>
+<title>CLIMA</title>
+</head>
+<body><div style='text-align: center'>
+<a href='/'><button>MAIN</button></a>
+<a href='config'><button>CONFIG</button></a>
+<a href='files'><button>FILES</button></a>
+)"""";
+
+const char html_footer[] PROGMEM = R""""(
+</div>
+</body>
+</html>
+)"""";
+
+const char html_javascript[] PROGMEM = R""""(
+<script>
+var canvas = document.getElementById('c');
+var ctx = canvas.getContext('2d');
+var myChart = new Chart(ctx, {
+  type: 'line',
+  data: {
+    labels: l,
+    datasets: [{
+      label: 'Temperature',
+      data: t,
+      borderColor: 'rgb(255, 0, 0)',
+      backgroundColor: 'rgb(255, 0, 0, 0.1)',
+      tension: 0.1,
+    }, {
+      label: 'Humidity',
+      data: h,
+      borderColor: 'rgb(0, 0, 255)',
+      backgroundColor: 'rgb(0, 0, 255, 0.1)',
+      tension: 0.1,}]
+    },
+  }
+);
+canvas = document.getElementById('a');
+ctx = canvas.getContext('2d');
+myChart = new Chart(ctx, {
+  type: 'line',
+  data: {
+    labels: l.slice(-24),
+    datasets: [{
+      label: 'Temperature',
+      data: t.slice(-24),
+      borderColor: 'rgb(255, 0, 0)',
+      backgroundColor: 'rgb(255, 0, 0, 0.1)',
+      tension: 0.1,
+    }]
+  },
+});
+canvas = document.getElementById('b');
+ctx = canvas.getContext('2d');
+myChart = new Chart(ctx, {
+  type: 'line',
+  data: {
+    labels: l.slice(-24),
+    datasets: [{
+      label: 'Humidity',
+      data: h.slice(-24),
+      borderColor: 'rgb(0, 0, 255)',
+      backgroundColor: 'rgb(0, 0, 255, 0.1)',
+      tension: 0.1,
+    }]
+  },
+});
+</script>
+)"""";
+
+void send_chunk(const uint8_t *data, size_t len, void *) {
+  server.sendContent((const char *)data, len);
+}
+
+/*
+replies are gzipped on the fly when the client takes it (one encoder,
+the server handles one request at a time)
+*/
+
+Gzip *gzip = nullptr;
+
+bool accepts_gzip() {
+  return strstr(server.header("Accept-Encoding").c_str(), "gzip");
+}
+
+void reply_begin(int code, const char *type,
+                 size_t len = CONTENT_LENGTH_UNKNOWN) {
+  gzip = accepts_gzip() ? new (std::nothrow) Gzip(send_chunk, nullptr)
+                        : nullptr;
+  server.sendHeader("Vary", "Accept-Encoding");
+  if (gzip) {
+    server.sendHeader("Content-Encoding", "gzip");
+    len = CONTENT_LENGTH_UNKNOWN;
+  }
+  server.setContentLength(len);
+  server.send(code, type, "");
+}
+
+void reply(const char *data, size_t len) {
+  if (gzip) {
+    gzip->write(data, len);
+  } else {
+    server.sendContent(data, len);
+  }
+}
+
+void reply(const char *z) { reply(z, strlen(z)); }
+
+void reply_P(const char *z) {
+  if (!gzip) {
+    server.sendContent_P(z);
+    return;
+  }
+  char buf[64];
+  size_t len = strlen_P(z);
+  for (size_t i = 0; i < len; i += sizeof(buf)) {
+    size_t n = (len - i < sizeof(buf)) ? len - i : sizeof(buf);
+    memcpy_P(buf, z + i, n);
+    gzip->write(buf, n);
+  }
+}
+
+void reply_chunk(const uint8_t *data, size_t len, void *) {
+  reply((const char *)data, len);
+}
+
+void reply_end() {
+  if (gzip) {
+    gzip->finish();
+    delete gzip;
+    gzip = nullptr;
+  }
+}
+
+void send_html(const char *z) {
+  reply_begin(200, "text/html");
+  reply_P(html_header);
+  reply(z);
+  reply_P(html_footer);
+  reply_end();
+}
+
+void handle_404() {
+#ifdef DEBUG
+  Serial.println("WWW 404");
+#endif
+  send_html("<p>Not found!</p>");
+}
+
+void handle_root() {
+// root
+#ifdef DEBUG
+  Serial.println("WWW ROOT");
+#endif
+
+  char buf[512];
+  get_sensors();
+  snprintf_P(buf, sizeof(buf),
+             PSTR("<div style='border: 1px solid black'>Temperature: %.01f<br>"
+                  "Humidity: %.01f<br>"
+                  "<br><canvas id='a' width='600' height='200'></canvas>"
+                  "<br><canvas id='b' width='600' height='200'></canvas>"
+                  "<br><canvas id='c' width='600' height='200'></canvas>"
+                  "</div>"),
+             temperature, humidity);
+
+  reply_begin(200, "text/html");
+  reply_P(html_header);
+  reply(buf);
+
+  // write javascript (graph arrays come from data.js)
+  reply("<script src='data.js'></script>");
+  reply_P(html_javascript);
+  reply_P(html_footer);
+  reply_end();
+}
+
+/*
+data.js: graph arrays, rendered once per new history entry and served with
+a strong ETag (build + last entry time + count), so reloads and pollers get
+a 304, and a firmware update with a new data.js format doesnt.
+labels go as seconds from the first entry, the browser formats them. a
+gzipped copy is kept too.
+*/
+
+char *data_js = nullptr, *data_js_gz = nullptr;
+size_t data_js_len = 0, data_js_gz_len = 0;
+char data_js_etag[32] = "";
+
+// bytes per entry, worst case ("-40.0," "100.0," "2592000,")
+#define DATA_JS_ENTRY 24
+// longest single printf
+#define DATA_JS_LINE 128
+
+// where data.js is written: a buffer, or the client (in small chunks)
+struct js_out {
+  char *buf;
+  size_t size, len;
+  bool stream;
+};
+
+void js_printf(js_out &o, const char *fmt, ...) {
+  if (o.stream && (o.len + DATA_JS_LINE > o.size)) {
+    reply(o.buf, o.len);
+    o.len = 0;
+  }
+  if (o.len < o.size) {
+    va_list ap;
+    va_start(ap, fmt);
+    o.len += vsnprintf(o.buf + o.len, o.size - o.len, fmt, ap);
+    va_end(ap);
+  }
+}
+
+// local time - utc (s)
+long utc_offset(time_t t) {
+  struct tm tm = *gmtime(&t);
+  tm.tm_isdst = -1;
+  return (long)(t - mktime(&tm));
+}
+
+// arrays for entries [start, start + count) of h
+void write_data_js(js_out &o, History &h, unsigned int start,
+                   unsigned int count) {
+  const TH_INFO *e = h.at(start);
+  time_t first = e ? e->tempo : 0;
+  js_printf(o, "const s = %ld, z = %ld;\nconst t = [", (long)first,
+            utc_offset(first));
+  for (unsigned int i = 0; i < count; i++) {
+    if ((e = h.at(start + i))) {
+      js_printf(o, "%.01f,", e->temperature);
+    }
+  }
+  js_printf(o, "];\nconst h = [");
+  for (unsigned int i = 0; i < count; i++) {
+    if ((e = h.at(start + i))) {
+      js_printf(o, "%.01f,", e->humidity);
+    }
+  }
+  js_printf(o, "];\nconst l = [");
+  for (unsigned int i = 0; i < count; i++) {
+    if ((e = h.at(start + i))) {
+      js_printf(o, "%ld,", (long)(e->tempo - first));
+    }
+  }
+  js_printf(o, "].map(x => new Date((s + x + z) * 1000)"
+               ".toLocaleString('pt-BR', {timeZone: 'UTC'}));\n");
+  if (o.stream) {
+    reply(o.buf, o.len);
+    o.len = 0;
+  }
+}
+
+void data_js_gz_append(const uint8_t *data, size_t len, void *) {
+  char *p = (char *)realloc(data_js_gz, data_js_gz_len + len);
+  if (p) {
+    memcpy(p + data_js_gz_len, data, len);
+    data_js_gz = p;
+    data_js_gz_len += len;
+  }
+}
+
+bool render_data_js(unsigned int start, unsigned int count) {
+  free(data_js);
+  free(data_js_gz);
+  data_js_gz = nullptr;
+  data_js_len = data_js_gz_len = 0;
+  data_js_etag[0] = 0;
+  js_out o = {nullptr, 256 + count * DATA_JS_ENTRY, 0, false};
+  if (!(o.buf = (char *)malloc(o.size))) {
+    return false;
+  }
+  write_data_js(o, history, start, count);
+  if (o.len >= o.size) {
+    free(o.buf);
+    return false;
+  }
+  // give back the slack
+  char *p = (char *)realloc(o.buf, o.len + 1);
+  data_js = p ? p : o.buf;
+  data_js_len = o.len;
+
+  // compressed copy (served plain if it doesn't fit)
+  Gzip *gz = new (std::nothrow) Gzip(data_js_gz_append, nullptr);
+  if (gz) {
+    gz->write(data_js, data_js_len);
+    gz->finish();
+    if (gz->bytes_out() != data_js_gz_len) {
+      free(data_js_gz);
+      data_js_gz = nullptr;
+      data_js_gz_len = 0;
+    }
+    delete gz;
+  }
+  return true;
+}
+
+// imported month (/MMYYYY.bin), nullptr if there's none
+const char *month_file(char *path, size_t len) {
+  String m = server.arg("m");
+  if ((m.length() != 6) ||
+      (snprintf(path, len, "/%s.bin", m.c_str()) >= (int)len) ||
+      !storage.exists(path)) {
+    return nullptr;
+  }
+  return path;
+}
+
+void handle_month_data() {
+  char path[16];
+  if (!month_file(path, sizeof(path))) {
+    handle_404();
+    return;
+  }
+  // whole month, streamed from flash
+  History month(storage, path);
+  month.begin();
+  char buf[256];
+  js_out o = {buf, sizeof(buf), 0, true};
+  reply_begin(200, "application/javascript");
+  write_data_js(o, month, 0, month.count());
+  reply_end();
+}
+
+void handle_month() {
+// imported month graph
+#ifdef DEBUG
+  Serial.println("WWW MONTH");
+#endif
+  char path[16], buf[256];
+  if (!month_file(path, sizeof(path))) {
+    handle_404();
+    return;
+  }
+  snprintf_P(buf, sizeof(buf),
+             PSTR("<div style='border: 1px solid black'>%.2s/%.4s<br>"
+                  "<br><canvas id='a' width='600' height='200'></canvas>"
+                  "<br><canvas id='b' width='600' height='200'></canvas>"
+                  "<br><canvas id='c' width='600' height='200'></canvas>"
+                  "</div><script src='data.js?m=%.6s'></script>"),
+             path + 1, path + 3, path + 1);
+  reply_begin(200, "text/html");
+  reply_P(html_header);
+  reply(buf);
+  reply_P(html_javascript);
+  reply_P(html_footer);
+  reply_end();
+}
+
+void handle_data() {
+#ifdef DEBUG
+  Serial.println("WWW DATA");
+#endif
+  if (server.hasArg("m")) {
+    handle_month_data();
+    return;
+  }
+
+  // calcula quantos itens vamos mostrar
+  unsigned int th_index = history.count();
+  int count = (th_index > GRAPH_RANGE) ? GRAPH_RANGE : th_index;
+  int start = (th_index > GRAPH_RANGE) ? th_index - GRAPH_RANGE : 0;
+
+  const TH_INFO *e = history.last();
+  char key[32];
+  snprintf(key, sizeof(key), "%s-%lx-%x", BUILD_NUMBER,
+           e ? (unsigned long)e->tempo : 0UL, th_index);
+  if (strcmp(key, data_js_etag)) {
+    if (!render_data_js(start, count)) {
+      server.send(500, "text/plain", "Out of memory");
+      return;
+    }
+    strcpy(data_js_etag, key);
+  }
+
+  // each encoding has its own etag
+  bool gz = data_js_gz && accepts_gzip();
+  char etag[40];
+  snprintf(etag, sizeof(etag), gz ? "\"%s-gz\"" : "\"%s\"", key);
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("Vary", "Accept-Encoding");
+  if (strstr(server.header("If-None-Match").c_str(), etag)) {
+    server.send(304);
+    return;
+  }
+  if (gz) {
+    server.sendHeader("Content-Encoding", "gzip");
+    server.send(200, "application/javascript", data_js_gz, data_js_gz_len);
+  } else {
+    server.send(200, "application/javascript", data_js, data_js_len);
+  }
+}
+
+void handle_raw() {
+// raw data
+#ifdef DEBUG
+  Serial.println("WWW RAW");
+#endif
+
+  char buf[512];
+  get_sensors();
+  snprintf(buf, sizeof(buf), "%.2f\n%.2f\n", temperature, humidity);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send_P(200, "text/plain", buf);
+}
+
+void list_file(const char *name, size_t size, time_t t, void *) {
+  char buf[256];
+  snprintf_P(buf, sizeof(buf),
+             PSTR("<a download='%s' href='files?n=%s'>%s</a>    (%u)    %s"
+                  "<a href='files?x=%s'>x</a>"),
+             name, name, name, (unsigned int)size, ctime(&t), name);
+  reply(buf);
+  // imported month
+  if ((strlen(name) == 11) && !strcmp(name + 7, ".bin")) {
+    snprintf_P(buf, sizeof(buf), PSTR("    <a href='month?m=%.6s'>graph</a>"),
+               name + 1);
+    reply(buf);
+  }
+  reply("<br>");
+}
+
+void handle_files() {
+  char buf[512];
+  if (server.hasArg("n")) {
+#ifdef DEBUG
+    Serial.println("WWW FILE DOWNLOAD");
+#endif
+    // download
+    String fname = server.arg("n");
+    reply_begin(200, "application/octet-stream", storage.size(fname.c_str()));
+    storage.stream(fname.c_str(), buf, sizeof(buf), reply_chunk, nullptr);
+    reply_end();
+  } else if (server.hasArg("x")) {
+#ifdef DEBUG
+    Serial.println("WWW FILE DELETE");
+#endif
+    // delete
+    String fname = server.arg("x");
+    storage.remove(fname.c_str());
+    server.send(200, "text/html",
+                "<script>document.location.href = '/files'</script>");
+  } else {
+// dir
+#ifdef DEBUG
+    Serial.println("WWW FILE");
+#endif
+
+    reply_begin(200, "text/html");
+    reply_P(html_header);
+    reply("<div style='border: 1px solid black'>");
+
+    // scan files
+    storage.list(list_file, nullptr);
+#ifdef ENABLE_WWW_UPLOAD
+    reply("<form action='/upload' method='POST' "
+          "enctype='multipart/form-data'><input type='file' name='name'><input "
+          "class='button' type='submit' value='Upload'></form>");
+#endif
+    reply("</div>");
+    reply_P(html_footer);
+    reply_end();
+  }
+}
+
+void handle_description() {
+  // SSDP schema
+  SSDP_esp8266.schema(server.client());
+}
+
+void web_begin() {
+  // install www handlers (main, data and discovery pages)
+  static const char *headers[] = {"If-None-Match", "Accept-Encoding",
+                                  "Content-Length"};
+  server.collectHeaders(headers, sizeof(headers) / sizeof(headers[0]));
+  server.onNotFound(handle_404);
+  server.on("/", handle_root);
+  server.on("/data.js", HTTP_GET, handle_data);
+  server.on("/month", handle_month);
+  server.on("/raw", handle_raw);
+  server.on("/files", handle_files);
+  server.on("/description.xml", HTTP_GET, handle_description);
+}
+
+#endif
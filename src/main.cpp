@@ -25,8 +25,17 @@ v1:
 v1.1:
 * BME280 support
 
-TODO:
-* show monthly history (read from disk)
+v1.2:
+* history paged from flash (small LRU page cache in RAM)
+* cooperative scheduler, CSV export runs in background
+* alert rules (rolling min/max/mean/rate, hysteresis) published on MQTT
+* www pages split to web.h, host load test (tools/loadtest)
+* graph arrays in a cached data.js (ETag/304)
+* gzip on the fly for pages and downloads (Accept-Encoding)
+* LittleFS (SPIFFS migrated on first boot), /bench filesystem benchmark
+* uploads buffered in 4 KB blocks, temp file renamed when complete
+* monthly CSVs imported back to binary (/MMYYYY.bin), month graphs
+* low power mode: deep sleep, samples kept in RTC memory, batched flush
 */
 
 #if !defined(ESP8266)
@@ -37,6 +46,17 @@ TODO:
 
 // #define DAILY_FILE
 
+// LittleFS (SPIFFS data is migrated on first boot), comment for SPIFFS
+#define STORAGE_LITTLEFS
+
+// battery: deep sleep between samples (GPIO16 wired to RST), WiFi only
+// every LOW_POWER_BATCH samples (at most LOW_POWER_SAMPLES / 2). no www,
+// discovery or alerts
+// #define LOW_POWER
+#define LOW_POWER_BATCH 12
+#define LOW_POWER_PERIOD 3600 // s
+#define LOW_POWER_WIFI 10000  // ms
+
 #define SENSOR_BME280
 
 const char *device_name = "CLIMA";
@@ -62,12 +82,22 @@ const char *device_name = "CLIMA";
 #include <WEMOS_SHT3X.h>
 #endif
 
+#include "alerts.h"
+#include "csv_export.h"
+#include "csv_import.h"
+#include "flash_fs.h"
+#include "history.h"
+#include "logger.h"
+#include "low_power.h"
+#include "scheduler.h"
+#include "storage.h"
+#include "upload.h"
 #include "version.h"
 
 // time
 #define GETTIME_RETRIES 30
 bool notime;
-time_t boot_time, current_time;
+time_t boot_time;
 
 // sensor
 #ifdef SENSOR_BME280
@@ -97,12 +127,18 @@ float temperature = 0, humidity = 0;
 #define MQTT_CLIMA_LOCALIP "CLIMA/IP"
 #define MQTT_CLIMA_TEMPERATURE "CLIMA/TEMPERATURE"
 #define MQTT_CLIMA_HUMIDITY "CLIMA/HUMIDITY"
+#define MQTT_CLIMA_ALERT "CLIMA/ALERT/%08X/%d"
+// per station, "time, t, h". chip id as the SSDP serial number (collector
+// station id)
+#define MQTT_CLIMA_LIVE "CLIMA/LIVE/%08X"
+#define MQTT_CLIMA_BATCH "CLIMA/BATCH/%08X"
 unsigned long mqtt_interval;
 WiFiClient mqtt_client;
 PubSubClient mqtt(mqtt_client);
 
-// eeprom
-#define EEPROM_SIGNATURE 'J'
+// eeprom, the older layout ('J', no alerts) is a prefix of this one and is
+// migrated on boot
+#define EEPROM_SIGNATURE 'M'
 struct eeprom_data {
   char sign = EEPROM_SIGNATURE;
   bool mqtt_enabled;
@@ -110,7 +146,17 @@ struct eeprom_data {
   unsigned int mqtt_server_port = 1883;
   char mqtt_username[32];
   char mqtt_password[32];
+  alert_rule alert[ALERT_RULES];
 } eeprom;
+// 'J' image size (ESP_EEPROM only reads an image back at its own size)
+#define EEPROM_SIZE_J offsetof(eeprom_data, alert)
+
+// alerts
+Alerts alerts;
+unsigned long alerts_interval;
+const char *alert_metrics[] = {"Temperature", "Humidity"};
+const char *alert_stats[] = {"Value", "Mean", "Min", "Max", "Rate/h"};
+const char *alert_ops[] = {">", "<"};
 
 // www
 WiFiManager wm;
@@ -121,14 +167,42 @@ ESP8266HTTPUpdateServer httpUpdater;
 
 // graph
 #define GRAPH_RANGE 24 * 7
-#define MAX_TH_INFO 24 * 32
-struct TH_INFO {
-  time_t tempo;
-  float temperature;
-  float humidity;
+
+// history (current month, binary cache on flash)
+FSStorage storage(SPIFFS);
+History history(storage, "/CACHE");
+CsvExport csv_export(storage);
+void log_sensors(float &t, float &h);
+Logger logger(storage, history, csv_export, log_sensors);
+// monthly CSVs back to binary (/MMYYYY.bin)
+CsvImport csv_import(storage);
+
+#ifdef LOW_POWER
+// samples buffered across deep sleeps (RTC user memory image)
+rtc_data rtc;
+LowPower low_power(rtc, LOW_POWER_BATCH, LOW_POWER_PERIOD);
+#endif
+
+// scheduler
+bool task_www();
+bool task_mqtt();
+bool task_log();
+bool task_alerts();
+bool task_discovery();
+bool task_export();
+bool task_import();
+
+// name, period (ms), priority, budget (us), function
+Task tasks[] = {
+    TASK("www", 0, 3, 50000, task_www),
+    TASK("mqtt", 100, 2, 20000, task_mqtt),
+    TASK("log", 1000, 2, 50000, task_log),
+    TASK("alerts", 1000, 2, 20000, task_alerts),
+    TASK("discovery", 50, 1, 10000, task_discovery),
+    TASK("export", 100, 0, 20000, task_export),
+    TASK("import", 100, 0, 20000, task_import),
 };
-TH_INFO th_info[MAX_TH_INFO];
-unsigned int th_index = 0;
+Scheduler scheduler(tasks, sizeof(tasks) / sizeof(Task));
 
 /*
 ██╗  ██╗████████╗███╗   ███╗██╗
@@ -139,29 +213,6 @@ unsigned int th_index = 0;
 ╚═╝  ╚═╝   ╚═╝   ╚═╝     ╚═╝╚══════╝
 */
 
-const char html_header[] PROGMEM = R""""(<!DOCTYPE html>
-<html lang='pt-br'>
-<head>
-<meta charset='UTF-8'>
-<meta name='viewport' content='width=device-width, initial-scale=1'>
-<meta http-equiv='cache-control' content='no-cache, no-store, must-revalidate'>
-<meta http-equiv='refresh' content='600; url=/'>
-<script src='https://cdn.jsdelivr.net/npm/chart.js'></script>
-<link rel='stylesheet' href='https://cdn.simplecss.org/simple.min.css'>
-<title>CLIMA</title>
-</head>
-<body><div style='text-align: center'>
-<a href='/'><button>MAIN</button></a>
-<a href='config'><button>CONFIG</button></a>
-<a href='files'><button>FILES</button></a>
-)"""";
-
-const char html_footer[] PROGMEM = R""""(
-</div>
-</body>
-</html>
-)"""";
-
 const char html_config[] PROGMEM = R""""(
 <div style='border: 1px solid black'>
 Version: %s<br>
@@ -170,6 +221,7 @@ Last reading: %s<br>
 IP: %s<br>
 ESP.getSketchSize(): %d<br>
 ESP.getFreeSketchSpace(): %d<br>
+Filesystem: %s<br>
 fs_info.totalBytes(): %d<br>
 fs_info.usedBytes(): %d<br>
 </div>
@@ -183,61 +235,6 @@ const char html_config2[] PROGMEM = R""""(
 <a href='reset'><button>RESET</button></a>
 )"""";
 
-const char html_javascript[] PROGMEM = R""""(];
-var canvas = document.getElementById('c');
-var ctx = canvas.getContext('2d');
-var myChart = new Chart(ctx, {
-  type: 'line',
-  data: {
-    labels: l,
-    datasets: [{
-      label: 'Temperature',
-      data: t,
-      borderColor: 'rgb(255, 0, 0)',
-      backgroundColor: 'rgb(255, 0, 0, 0.1)',
-      tension: 0.1,
-    }, {
-      label: 'Humidity',
-      data: h,
-      borderColor: 'rgb(0, 0, 255)',
-      backgroundColor: 'rgb(0, 0, 255, 0.1)',
-      tension: 0.1,}]
-    },
-  }
-);
-canvas = document.getElementById('a');
-ctx = canvas.getContext('2d');
-myChart = new Chart(ctx, {
-  type: 'line',
-  data: {
-    labels: l.slice(-24),
-    datasets: [{
-      label: 'Temperature',
-      data: t.slice(-24),
-      borderColor: 'rgb(255, 0, 0)',
-      backgroundColor: 'rgb(255, 0, 0, 0.1)',
-      tension: 0.1,
-    }]
-  },
-});
-canvas = document.getElementById('b');
-ctx = canvas.getContext('2d');
-myChart = new Chart(ctx, {
-  type: 'line',
-  data: {
-    labels: l.slice(-24),
-    datasets: [{
-      label: 'Humidity',
-      data: h.slice(-24),
-      borderColor: 'rgb(0, 0, 255)',
-      backgroundColor: 'rgb(0, 0, 255, 0.1)',
-      tension: 0.1,
-    }]
-  },
-});
-</script>
-)"""";
-
 /*
 ███████╗███████╗███╗   ██╗███████╗ ██████╗ ██████╗
 ██╔════╝██╔════╝████╗  ██║██╔════╝██╔═══██╗██╔══██╗
@@ -247,6 +244,27 @@ myChart = new Chart(ctx, {
 ╚══════╝╚══════╝╚═╝  ╚═══╝╚══════╝ ╚═════╝ ╚═╝  ╚═╝
 */
 
+void sensor_begin() {
+#ifdef SENSOR_BME280
+  unsigned status = bme.begin();
+  // You can also pass in a Wire library object like &Wire2
+  // status = bme.begin(0x76, &Wire2)
+  if (!status) {
+    Serial.println("Could not find a valid BME280 sensor, check wiring, "
+                   "address, sensor ID!");
+    Serial.print("SensorID was: 0x");
+    Serial.println(bme.sensorID(), 16);
+    Serial.print("        ID of 0xFF probably means a bad address, a BMP 180 "
+                 "or BMP 085\n");
+    Serial.print("   ID of 0x56-0x58 represents a BMP 280,\n");
+    Serial.print("        ID of 0x60 represents a BME 280.\n");
+    Serial.print("        ID of 0x61 represents a BME 680.\n");
+    while (1)
+      delay(10);
+  }
+#endif
+}
+
 void get_sensors() {
   // read sensors
 
@@ -270,6 +288,13 @@ void get_sensors() {
 #endif
 }
 
+void log_sensors(float &t, float &h) {
+  // sample for the logger
+  get_sensors();
+  t = temperature;
+  h = humidity;
+}
+
 /*
 ██╗    ██╗███████╗██████╗
 ██║    ██║██╔════╝██╔══██╗
@@ -279,85 +304,23 @@ void get_sensors() {
  ╚══╝╚══╝ ╚══════╝╚═════╝
 */
 
-void send_html(const char *z) {
-  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  server.send_P(200, "text/html", html_header);
-  server.sendContent(z);
-  server.sendContent(html_footer);
-}
-
-void handle_404() {
-#ifdef DEBUG
-  Serial.println("WWW 404");
-#endif
-  send_html("<p>Not found!</p>");
-}
-
-void handle_root() {
-// root
-#ifdef DEBUG
-  Serial.println("WWW ROOT");
-#endif
-
-  char buf[512];
-  get_sensors();
-  snprintf_P(buf, sizeof(buf),
-             PSTR("<div style='border: 1px solid black'>Temperature: %.01f<br>"
-                  "Humidity: %.01f<br>"
-                  "<br><canvas id='a' width='600' height='200'></canvas>"
-                  "<br><canvas id='b' width='600' height='200'></canvas>"
-                  "<br><canvas id='c' width='600' height='200'></canvas>"
-                  "</div>"),
-             temperature, humidity, th_index);
-
-  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  server.send_P(200, "text/html", html_header);
-  server.sendContent(buf);
-
-  // calcula quantos itens vamos mostrar
-  int count = (th_index > GRAPH_RANGE) ? GRAPH_RANGE : th_index;
-  int start = (th_index > GRAPH_RANGE) ? th_index - GRAPH_RANGE : 0;
-
-  // write javascript variables
-  server.sendContent("<script>const t = [");
-  for (int i = 0; i < count; i++) {
-    snprintf_P(buf, sizeof(buf), "%.01f,", th_info[start + i].temperature);
-    server.sendContent(buf);
-  }
-  server.sendContent("];\nconst h = [");
-  for (int i = 0; i < count; i++) {
-    snprintf_P(buf, sizeof(buf), "%.01f,", th_info[start + i].humidity);
-    server.sendContent(buf);
-  }
-  server.sendContent("];\nconst l = [");
-  for (int i = 0; i < count; i++) {
-    strftime(buf, sizeof(buf), "\"%c\",", localtime(&th_info[start + i].tempo));
-    server.sendContent(buf);
-  }
-
-  // write javascript
-  server.sendContent_P(html_javascript);
-  server.sendContent(html_footer);
-}
-
-void handle_raw() {
-// raw data
-#ifdef DEBUG
-  Serial.println("WWW RAW");
-#endif
-
-  char buf[512];
-  get_sensors();
-  snprintf(buf, sizeof(buf), "%.2f\n%.2f\n", temperature, humidity);
-  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  server.send_P(200, "text/plain", buf);
-}
+#include "web.h"
 
 #define FORM_SAVE_STRING(VAR)                                                  \
   strncpy(eeprom.VAR, server.arg(#VAR).c_str(), sizeof(eeprom.VAR));
 #define FORM_SAVE_INT(VAR) eeprom.VAR = server.arg(#VAR).toInt();
 #define FORM_SAVE_BOOL(VAR)                                                    \
   eeprom.VAR = server.arg(#VAR) == "on" ? true : false;
+#define FORM_SAVE_FLOAT(VAR) eeprom.VAR = server.arg(#VAR).toFloat();
+#define FORM_SAVE_RULE(N)                                                      \
+  FORM_SAVE_BOOL(alert[N].enabled);                                            \
+  FORM_SAVE_INT(alert[N].metric);                                              \
+  FORM_SAVE_INT(alert[N].stat);                                                \
+  FORM_SAVE_INT(alert[N].op);                                                  \
+  FORM_SAVE_FLOAT(alert[N].threshold);                                         \
+  FORM_SAVE_FLOAT(alert[N].hysteresis);                                        \
+  eeprom.alert[N].window =                                                     \
+      alert_window(server.arg("alert[" #N "].window").toInt());
 
 #define FORM_START(URL)                                                        \
   s += "<form action='" + String(URL) + "' method='POST'>";
@@ -369,6 +332,23 @@ void handle_raw() {
   s += "<label for='" + String(#VAR) + "'>" + String(TXT) +                    \
        ":</label><input type='checkbox' name='" + String(#VAR) + "' " +        \
        String(eeprom.VAR ? "checked" : "") + "><br>";
+#define FORM_ASK_SELECT(VAR, TXT, OPTIONS)                                      \
+  s += "<label for='" + String(#VAR) + "'>" + String(TXT) +                    \
+       ":</label><select name='" + String(#VAR) + "'>";                        \
+  for (unsigned int o = 0; o < sizeof(OPTIONS) / sizeof(OPTIONS[0]); o++) {  \
+    s += "<option value='" + String(o) + "'" +                                 \
+         String(eeprom.VAR == o ? " selected" : "") + ">" + OPTIONS[o] +       \
+         "</option>";                                                          \
+  }                                                                            \
+  s += "</select><br>";
+#define FORM_ASK_RULE(N)                                                       \
+  FORM_ASK_BOOL(alert[N].enabled, "Alert " #N);                                \
+  FORM_ASK_SELECT(alert[N].metric, "Sensor", alert_metrics);                   \
+  FORM_ASK_SELECT(alert[N].stat, "Statistic", alert_stats);                    \
+  FORM_ASK_SELECT(alert[N].op, "Condition", alert_ops);                        \
+  FORM_ASK_VALUE(alert[N].threshold, "Threshold");                             \
+  FORM_ASK_VALUE(alert[N].hysteresis, "Hysteresis");                           \
+  FORM_ASK_VALUE(alert[N].window, "Window (s)");
 #define FORM_END(BTN)                                                          \
   s +=                                                                         \
       "<input type='hidden' name='s' value='1'><input type='submit' value='" + \
@@ -384,8 +364,12 @@ void handle_config() {
     FORM_SAVE_INT(mqtt_server_port);
     FORM_SAVE_STRING(mqtt_username);
     FORM_SAVE_STRING(mqtt_password);
+    FORM_SAVE_RULE(0);
+    FORM_SAVE_RULE(1);
+    FORM_SAVE_RULE(2);
     EEPROM.put(0, eeprom);
     EEPROM.commit();
+    alerts.begin(eeprom.alert);
     server.send(200, "text/html",
                 "<meta http-equiv='refresh' content='0; url=/config' />");
   } else {
@@ -395,17 +379,17 @@ void handle_config() {
 #endif
     char buf[1536];
 
-    FSInfo fs_info;
-    SPIFFS.info(fs_info);
+    size_t fs_total = 0, fs_used = 0;
+    storage.info(fs_total, fs_used);
 
     char t1[32], t2[32];
     ctime_r(&boot_time, t1);
-    ctime_r(&current_time, t2);
+    ctime_r(&logger.current, t2);
 
     snprintf_P(buf, sizeof(buf), html_config, VERSION, t1,
                notime ? "<font color='red'>NOTIME</font>" : t2,
                WiFi.localIP().toString().c_str(), ESP.getSketchSize(),
-               ESP.getFreeSketchSpace(), fs_info.totalBytes, fs_info.usedBytes);
+               ESP.getFreeSketchSpace(), fs_name, fs_total, fs_used);
 
     String s = buf;
     FORM_START("/config");
@@ -414,7 +398,40 @@ void handle_config() {
     FORM_ASK_VALUE(mqtt_server_port, "MQTT Broker Port");
     FORM_ASK_VALUE(mqtt_username, "MQTT Username");
     FORM_ASK_VALUE(mqtt_password, "MQTT Password");
+    FORM_ASK_RULE(0);
+    FORM_ASK_RULE(1);
+    FORM_ASK_RULE(2);
     FORM_END("Salvar");
+
+    // where loop time goes
+    s += "</div><div style='border: 1px solid black'>";
+    snprintf_P(buf, sizeof(buf), PSTR("Loops: %lu (%lu us avg)<br>"),
+               scheduler.loop_count(),
+               scheduler.loop_count()
+                   ? (unsigned long)(scheduler.loop_time() /
+                                     scheduler.loop_count())
+                   : 0);
+    s += buf;
+    for (size_t i = 0; i < scheduler.size(); i++) {
+      const Task &t = scheduler.task(i);
+      snprintf_P(buf, sizeof(buf),
+                 PSTR("%s: %lu runs, %lu us avg, %lu us max, %lu over "
+                      "budget<br>"),
+                 t.name, t.runs,
+                 t.runs ? (unsigned long)(t.total_us / t.runs) : 0, t.max_us,
+                 t.overruns);
+      s += buf;
+    }
+
+    // alert state
+    for (int i = 0; i < ALERT_RULES; i++) {
+      if (eeprom.alert[i].enabled) {
+        snprintf_P(buf, sizeof(buf), PSTR("Alert %d: %s (%.02f)<br>"), i,
+                   alerts.active(i) ? "<font color='red'>ON</font>" : "OFF",
+                   alerts.value(i));
+        s += buf;
+      }
+    }
     s += html_config2;
 
     send_html(s.c_str());
@@ -448,85 +465,201 @@ void handle_reset() {
   handle_reboot();
 }
 
-void handle_files() {
-  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  char buf[512];
-  if (server.hasArg("n")) {
-#ifdef DEBUG
-    Serial.println("WWW FILE DOWNLOAD");
-#endif
-    // download
-    String fname = server.arg("n");
-    File f = SPIFFS.open(fname, "r");
-    server.setContentLength(f.size());
-    server.send(200, "application/octet-stream", "");
-    int r;
-    do {
-      r = f.read((uint8_t *)&buf, sizeof(buf));
-      server.sendContent(buf, r);
-    } while (r == sizeof(buf));
-    f.close();
-  } else if (server.hasArg("x")) {
+#define BENCH_RUNS 64
+#define BENCH_GZIP_RUNS 4
+
+// gzip source: up to len bytes at pos
+typedef size_t (*bench_src)(size_t pos, uint8_t *buf, size_t len,
+                            const void *arg);
+
+size_t bench_src_P(size_t pos, uint8_t *buf, size_t len, const void *arg) {
+  const char *p = (const char *)arg;
+  size_t n = strlen_P(p);
+  n = (pos < n) ? n - pos : 0;
+  n = (n < len) ? n : len;
+  memcpy_P(buf, p + pos, n);
+  return n;
+}
+
+size_t bench_src_data_js(size_t pos, uint8_t *buf, size_t len, const void *) {
+  size_t n = (pos < data_js_len) ? data_js_len - pos : 0;
+  n = (n < len) ? n : len;
+  memcpy(buf, data_js + pos, n);
+  return n;
+}
+
+size_t bench_src_file(size_t pos, uint8_t *buf, size_t len, const void *arg) {
+  return storage.read((const char *)arg, pos, buf, len);
+}
+
+void bench_gzip_out(const uint8_t *, size_t len, void *arg) {
+  *(size_t *)arg += len;
+}
+
+// gzip cost on the device, like reply() does it (file reads included)
+void bench_gzip(String &s, const char *name, bench_src src, const void *arg) {
+  uint8_t buf[512];
+  unsigned long total = 0, max_us = 0;
+  size_t in = 0, out = 0;
+  for (int i = 0; i < BENCH_GZIP_RUNS; i++) {
+    out = 0;
+    Gzip *gz = new (std::nothrow) Gzip(bench_gzip_out, &out);
+    if (!gz) {
+      s += String(name) + "\tout of memory\n";
+      return;
+    }
+    size_t n;
+    in = 0;
+    unsigned long t = micros();
+    while ((n = src(in, buf, sizeof(buf), arg))) {
+      gz->write(buf, n);
+      in += n;
+      yield();
+    }
+    gz->finish();
+    t = micros() - t;
+    delete gz;
+    total += t;
+    max_us = (t > max_us) ? t : max_us;
+  }
+  char line[128];
+  snprintf_P(line, sizeof(line), PSTR("%s\t%d\t%u\t%u\t%lu\t%lu\t%lu\n"),
+             name, BENCH_GZIP_RUNS, (unsigned int)in, (unsigned int)out,
+             total / BENCH_GZIP_RUNS, max_us,
+             in ? (unsigned long)((unsigned long long)total * 1024 /
+                                  BENCH_GZIP_RUNS / in)
+                : 0);
+  s += line;
+}
+
+void bench_find_csv(const char *name, size_t, time_t, void *arg) {
+  size_t len = strlen(name);
+  if (!*(char *)arg && (len > 4) && (len < 32) &&
+      !strcmp(name + len - 4, ".csv")) {
+    strcpy((char *)arg, name);
+  }
+}
+
+void handle_bench() {
+// filesystem benchmark, our access pattern on a scratch file: hourly
+// appends, opens, history page reads, file list and archive rename. then
+// the cost of gzipping the root page script, data.js and a CSV archive
 #ifdef DEBUG
-    Serial.println("WWW FILE DELETE");
+  Serial.println("WWW BENCH");
 #endif
-    // delete
-    String fname = server.arg("x");
-    SPIFFS.remove(fname);
-    server.send(200, "text/html",
-                "<script>document.location.href = '/files'</script>");
-  } else {
-// dir
-#ifdef DEBUG
-    Serial.println("WWW FILE");
-#endif
-
-    String s;
-    server.send_P(200, "text/html", html_header);
-    server.sendContent("<div style='border: 1px solid black'>");
-
-    // scan files
-    Dir dir = SPIFFS.openDir("");
-    while (dir.next()) {
-      if (dir.isFile()) {
-        s = "<a download='" + dir.fileName() +
-            "' href='files?n=" + dir.fileName() + "'>" + dir.fileName() +
-            "</a>";
-        itoa(dir.fileSize(), buf, 10);
-        s += "    (" + String(buf) + ")    ";
-        const time_t t = dir.fileTime();
-        s += String(ctime(&t));
-        s += "<a href='files?x=" + dir.fileName() + "'>x</a><br>";
-        server.sendContent(s);
+  const char *ops[] = {"append", "open", "read", "list", "rename"};
+  const char *path = "/BENCH";
+  int runs = server.hasArg("n") ? server.arg("n").toInt() : BENCH_RUNS;
+  runs = (runs > 0) ? runs : BENCH_RUNS;
+  TH_INFO e = {};
+  uint8_t page[HISTORY_PAGE_ENTRIES * sizeof(TH_INFO)];
+  char buf[160];
+
+  String s = "# fs\top\truns\tavg_us\tmax_us\tbytes\tflash_written\t"
+             "flash_erased\tamplification\n";
+  storage.remove(path);
+  for (unsigned int op = 0; op < sizeof(ops) / sizeof(ops[0]); op++) {
+    unsigned long total = 0, max_us = 0;
+    size_t bytes = 0;
+    uint32_t written = flash_written, erased = flash_erased;
+    size_t pages = storage.size(path) / sizeof(page) + 1;
+    for (int i = 0; i < runs; i++) {
+      unsigned long t = micros();
+      switch (op) {
+      case 0:
+        e.tempo = i * 3600;
+        bytes += storage.append(path, &e, sizeof(e));
+        break;
+      case 1:
+        storage.size(path);
+        break;
+      case 2:
+        storage.read(path, (i % pages) * sizeof(page), page, sizeof(page));
+        break;
+      case 3:
+        storage.list([](const char *, size_t, time_t, void *) {}, nullptr);
+        break;
+      case 4:
+        storage.rename(path, "/BENCH.tmp");
+        storage.rename("/BENCH.tmp", path);
+        break;
       }
+      t = micros() - t;
+      total += t;
+      max_us = (t > max_us) ? t : max_us;
+      yield();
     }
-#ifdef ENABLE_WWW_UPLOAD
-    server.sendContent(
-        "<form action='/upload' method='POST' "
-        "enctype='multipart/form-data'><input type='file' name='name'><input "
-        "class='button' type='submit' value='Upload'></form>");
-#endif
-    server.sendContent("</div>");
-    server.sendContent(html_footer);
+    written = flash_written - written;
+    erased = flash_erased - erased;
+    snprintf_P(buf, sizeof(buf), PSTR("%s\t%s\t%d\t%lu\t%lu\t%u\t%u\t%u\t"),
+               fs_name, ops[op], runs, total / runs, max_us,
+               (unsigned int)bytes, (unsigned int)written,
+               (unsigned int)erased);
+    s += buf;
+    // flash bytes per byte appended
+    if (bytes) {
+      snprintf_P(buf, sizeof(buf), PSTR("%.1f\n"), (float)written / bytes);
+      s += buf;
+    } else {
+      s += "-\n";
+    }
+  }
+  storage.remove(path);
+
+  // gzip of what the www pages send
+  s += "# gzip\truns\tbytes\tgzip\tavg_us\tmax_us\tus_per_KB\n";
+  bench_gzip(s, "page", bench_src_P, html_javascript);
+  if (data_js) {
+    bench_gzip(s, "data.js", bench_src_data_js, nullptr);
+  }
+  char csv[32] = "";
+  storage.list(bench_find_csv, csv);
+  if (csv[0]) {
+    bench_gzip(s, csv, bench_src_file, csv);
   }
+  server.send(200, "text/plain", s);
 }
 
 #ifdef ENABLE_WWW_UPLOAD
-File fsUploadFile;
+Upload upload_file(storage);
 
 void handle_upload() {
-#ifdef DEBUG
-  Serial.println("WWW UPLOAD");
-#endif
   HTTPUpload &upload = server.upload();
   if (upload.status == UPLOAD_FILE_START) {
-    fsUploadFile = SPIFFS.open("/" + upload.filename, "w");
+#ifdef DEBUG
+    Serial.println("WWW UPLOAD " + upload.filename);
+#endif
+    // request size (a bit more than the file) is checked before writing
+    upload_file.begin(("/" + upload.filename).c_str(),
+                      server.header("Content-Length").toInt(), millis());
   } else if (upload.status == UPLOAD_FILE_WRITE) {
-    fsUploadFile.write(upload.buf, upload.currentSize);
+    upload_file.write(upload.buf, upload.currentSize);
   } else if (upload.status == UPLOAD_FILE_END) {
-    fsUploadFile.close();
+    // monthly archives are imported (again)
+    if (upload_file.end(millis())) {
+      csv_import.add(upload_file.file());
+    }
+  } else if (upload.status == UPLOAD_FILE_ABORTED) {
+    upload_file.abort();
   }
 }
+
+void handle_upload_done() {
+  char buf[256];
+  snprintf_P(buf, sizeof(buf),
+             PSTR("<meta http-equiv='refresh' content='3; url=/files' />"
+                  "%s %s: %u bytes in %lu ms (%.1f KB/s)"),
+             upload_file.message(), upload_file.file(),
+             (unsigned int)upload_file.bytes, upload_file.ms,
+             upload_file.rate());
+#ifdef DEBUG
+  Serial.println(buf);
+#endif
+  server.send((upload_file.result == UPLOAD_DONE)        ? 200
+              : (upload_file.result == UPLOAD_NO_SPACE) ? 413
+                                                        : 500,
+              "text/html", buf);
+}
 #endif
 
 /*
@@ -550,24 +683,138 @@ void get_time() {
   notime = (time(nullptr) < 1609459200) ? true : false;
 }
 
-void dump_csv(char *nome, unsigned int inicio) {
+#ifdef LOW_POWER
+/*
+low power mode, runs from setup() and never returns
+*/
+
+void low_power_store(const TH_INFO &e, void *) { logger.store(e); }
+
+// one sample on this station's batch topic
+bool low_power_send(const TH_INFO &e, void *topic) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%lld, %.2f, %.2f", (long long)e.tempo,
+           e.temperature, e.humidity);
+  return mqtt.publish((const char *)topic, buf);
+}
+
+// publish the batch (and what earlier wakes couldnt), before it's flushed
+void low_power_publish() {
   char buf[64];
+  mqtt.setServer(eeprom.mqtt_server, eeprom.mqtt_server_port);
+  if (!mqtt.connect(device_name, eeprom.mqtt_username,
+                    eeprom.mqtt_password)) {
+    return;
+  }
+  char topic[32];
+  snprintf(topic, sizeof(topic), MQTT_CLIMA_BATCH, ESP.getChipId());
+  low_power.publish(history, low_power_send, topic);
+#ifdef DEBUG
+  if (low_power.skipped) {
+    Serial.println("MQTT SKIPPED " + String(low_power.skipped));
+  }
+#endif
+  // latest values
+  snprintf(buf, sizeof(buf), "%.2f", temperature);
+  mqtt.publish(MQTT_CLIMA_TEMPERATURE, buf);
+  snprintf(buf, sizeof(buf), "%.2f", humidity);
+  mqtt.publish(MQTT_CLIMA_HUMIDITY, buf);
+  mqtt.disconnect();
+#ifdef DEBUG
+  Serial.println("MQTT BATCH");
+#endif
+}
 
-  // create
-  File f = SPIFFS.open(nome, "w");
-  if (f) {
-    // CSV header
-    f.printf("Hora, Data, Temperatura, Umidade\n");
-    // loop database
-    for (unsigned int i = inicio; i < (th_index - 1); i++) {
-      // write
-      strftime(buf, sizeof(buf), "%T, %d-%m-%Y", localtime(&th_info[i].tempo));
-      f.printf("%s, %.01f, %.01f\n", buf, th_info[i].temperature,
-               th_info[i].humidity);
+void low_power_wake() {
+  // buffer only survives a deep sleep
+  bool woke = ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE;
+  ESP.rtcUserMemoryRead(0, (uint32_t *)&rtc, sizeof(rtc));
+  low_power.begin(woke);
+  bool radio = low_power.radio();
+#ifdef DEBUG
+  Serial.println("WAKE " + String(rtc.count) + (radio ? " RADIO" : ""));
+#endif
+
+  if (radio) {
+    WiFi.mode(WIFI_STA);
+    WiFi.hostname(device_name);
+    if (!woke) {
+      // power on, wizard if there's no network yet
+      wm.setDebugOutput(false);
+      wm.setConfigPortalTimeout(180);
+      wm.autoConnect(device_name);
+    } else {
+      WiFi.begin();
+      while ((WiFi.status() != WL_CONNECTED) &&
+             (millis() < LOW_POWER_WIFI)) {
+        delay(10);
+      }
     }
-    // close
-    f.close();
+    if (WiFi.status() == WL_CONNECTED) {
+      get_time();
+      if (!notime) {
+        low_power.sync(time(NULL), millis());
+      }
+    }
+#ifdef DEBUG
+    Serial.println("TIME " + String(rtc.synced ? "OK" : "NONE"));
+#endif
+  }
+
+  sensor_begin();
+  get_sensors();
+  low_power.add(temperature, humidity);
+
+  // batch to flash (even without WiFi), then MQTT
+  if (low_power.full()) {
+    fs::FS &fs = fs_begin();
+    storage.use(fs, fs_rename_replaces(fs));
+    history.begin();
+    if ((WiFi.status() == WL_CONNECTED) && eeprom.mqtt_enabled) {
+      low_power_publish();
+    }
+    logger.begin(rtc.sample[0].tempo);
+    low_power.flush(low_power_store, nullptr);
+    // monthly export in one go, nothing else runs
+    csv_export.run();
+#ifdef DEBUG
+    Serial.println("FLUSH");
+#endif
+  }
+
+  // radio only on wakes that need it
+  low_power.seal();
+  ESP.rtcUserMemoryWrite(0, (uint32_t *)&rtc, sizeof(rtc));
+  ESP.deepSleep(low_power.sleep_us(millis()),
+                low_power.radio() ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+#endif
+
+// load config, migrating the older layout
+void eeprom_load() {
+  EEPROM.begin(sizeof(eeprom_data));
+  EEPROM.get(0, eeprom);
+  if (eeprom.sign == EEPROM_SIGNATURE) {
+    return;
   }
+  // default eeprom, keeping 'J' network settings
+  eeprom_data e = {};
+  uint8_t j[EEPROM_SIZE_J];
+  EEPROM.end();
+  EEPROM.begin(sizeof(j));
+  EEPROM.get(0, j);
+  if (j[0] == 'J') {
+    memcpy(&e, j, sizeof(j));
+  }
+  EEPROM.end();
+  EEPROM.begin(sizeof(eeprom_data));
+  eeprom = e;
+  eeprom.sign = EEPROM_SIGNATURE;
+  EEPROM.put(0, eeprom);
+  EEPROM.commit();
+#ifdef DEBUG
+  Serial.println("EEPROM MIGRATE");
+#endif
 }
 
 /*
@@ -585,18 +832,17 @@ void setup() {
   Serial.println("SETUP");
 #endif
 
-  EEPROM.begin(sizeof(eeprom_data));
-
   // if there's valid EEPROM config, load it
-  EEPROM.get(0, eeprom);
-  if (eeprom.sign != EEPROM_SIGNATURE) {
-    // default eeprom
-    eeprom = {};
-  }
+  eeprom_load();
+  alerts.begin(eeprom.alert);
 #ifdef DEBUG
   Serial.println("EEPROM");
 #endif
 
+#ifdef LOW_POWER
+  low_power_wake();
+#endif
+
   // setup WIFI
   WiFi.mode(WIFI_STA);
   delay(10);
@@ -629,23 +875,13 @@ void setup() {
 
   // install www handlers
   httpUpdater.setup(&server, "/update");
-  server.onNotFound(handle_404);
-  server.on("/", handle_root);
-  server.on("/raw", handle_raw);
+  web_begin();
   server.on("/config", handle_config);
   server.on("/reboot", handle_reboot);
   server.on("/reset", handle_reset);
-  server.on("/files", handle_files);
-  server.on("/description.xml", HTTP_GET,
-            []() { SSDP_esp8266.schema(server.client()); });
+  server.on("/bench", handle_bench);
 #ifdef ENABLE_WWW_UPLOAD
-  server.on(
-      "/upload", HTTP_POST,
-      []() {
-        server.send(200, "text/html",
-                    "<meta http-equiv='refresh' content='0; url=/files' />");
-      },
-      handle_upload);
+  server.on("/upload", HTTP_POST, handle_upload_done, handle_upload);
 #endif
   server.begin();
 #ifdef DEBUG
@@ -672,51 +908,37 @@ void setup() {
 
   // set boot/current time
   get_time();
-  current_time = boot_time = time(NULL);
+  boot_time = time(NULL);
 #ifdef DEBUG
   Serial.println("TIME");
 #endif
 
-#ifdef SENSOR_BME280
-  unsigned status = bme.begin();
-  // You can also pass in a Wire library object like &Wire2
-  // status = bme.begin(0x76, &Wire2)
-  if (!status) {
-    Serial.println("Could not find a valid BME280 sensor, check wiring, "
-                   "address, sensor ID!");
-    Serial.print("SensorID was: 0x");
-    Serial.println(bme.sensorID(), 16);
-    Serial.print("        ID of 0xFF probably means a bad address, a BMP 180 "
-                 "or BMP 085\n");
-    Serial.print("   ID of 0x56-0x58 represents a BMP 280,\n");
-    Serial.print("        ID of 0x60 represents a BME 280.\n");
-    Serial.print("        ID of 0x61 represents a BME 680.\n");
-    while (1)
-      delay(10);
-  }
-#endif
+  sensor_begin();
 
-  // init filesystem
-  SPIFFS.begin();
+  // init filesystem (migrates SPIFFS to LittleFS)
+  fs::FS &fs = fs_begin();
+  storage.use(fs, fs_rename_replaces(fs));
 #ifdef DEBUG
   Serial.println("FS");
 #endif
 
+#ifdef ENABLE_WWW_UPLOAD
+  // drop partial uploads
+  upload_file.cleanup();
+#endif
+
   // load temporary binary cache
-  File f = SPIFFS.open("/CACHE", "r");
-  if (f) {
-    th_index = f.read((uint8_t *)&th_info, sizeof(th_info));
-    th_index /= sizeof(TH_INFO);
-    f.close();
-    // get last read time from cache
-    if (th_index) {
-      current_time = th_info[th_index - 1].tempo;
-    }
-  }
+  history.begin();
+  logger.begin(boot_time);
 #ifdef DEBUG
   Serial.println("CACHE");
 #endif
 
+  // import archives (after a pending export, its CSV may be partial)
+  if (!csv_export.busy()) {
+    csv_import.scan();
+  }
+
   // setup end
 }
 
@@ -729,13 +951,20 @@ void setup() {
 ╚══════╝ ╚═════╝  ╚═════╝ ╚═╝
 */
 
-void loop() {
-  char buf[64];
-
+bool task_www() {
   // web things
   server.handleClient();
+  return false;
+}
+
+bool task_discovery() {
   MDNS.update();
   SSDP_esp8266.handleClient();
+  return false;
+}
+
+bool task_mqtt() {
+  char buf[64];
 
   // mqtt things
   if (eeprom.mqtt_enabled) {
@@ -752,82 +981,76 @@ void loop() {
       mqtt.publish(MQTT_CLIMA_TEMPERATURE, buf);
       snprintf(buf, sizeof(buf), "%.2f", humidity);
       mqtt.publish(MQTT_CLIMA_HUMIDITY, buf);
+      // same, tagged (topics above are shared by all stations)
+      if (!notime) {
+        char topic[32];
+        snprintf(topic, sizeof(topic), MQTT_CLIMA_LIVE, ESP.getChipId());
+        snprintf(buf, sizeof(buf), "%lld, %.2f, %.2f",
+                 (long long)time(NULL), temperature, humidity);
+        mqtt.publish(topic, buf);
+      }
 #ifdef DEBUG
       Serial.println("MQTT REFRESH");
 #endif
     }
+    // alert transitions (retained)
+    for (int i = 0; i < ALERT_RULES; i++) {
+      if (mqtt.connected() && (alerts.changed & (1 << i))) {
+        snprintf(buf, sizeof(buf), MQTT_CLIMA_ALERT, ESP.getChipId(), i);
+        if (mqtt.publish(buf, alerts.active(i) ? "ON" : "OFF", true)) {
+          alerts.changed &= ~(1 << i);
+#ifdef DEBUG
+          Serial.println("MQTT ALERT");
+#endif
+        }
+      }
+    }
     mqtt.loop();
   }
+  return false;
+}
+
+bool task_alerts() {
+  // sample sensors and check alert rules
+  if ((millis() - alerts_interval) >= alerts.period()) {
+    alerts_interval = millis();
+    get_sensors();
+    alerts.add(temperature, humidity, alerts_interval);
+  }
+  return false;
+}
 
+bool task_log() {
   // we cant do anything till we get the clock
   if (notime) {
     get_time();
-  } else {
-    struct tm now, last, yesterday;
-    // get date/time now
-    time_t t = time(NULL);
-    localtime_r(&t, &now);
-    // get last update date
-    localtime_r(&current_time, &last);
-    // get yesterday date (for filenames porpouse)
-    yesterday = now;
-    yesterday.tm_mday--;
-    mktime(&yesterday);
-
-    // check if hour changed
-    if (now.tm_hour != last.tm_hour) {
-      current_time = t;
-      get_sensors();
-
-      // log temperatura and humidity
-      th_info[th_index].tempo = t;
-      th_info[th_index].temperature = temperature;
-      th_info[th_index].humidity = humidity;
-      th_index++;
-
-      // write temporary binary cache
-      File f = SPIFFS.open("/CACHE", "w");
-      if (f) {
-        f.write((uint8_t *)&th_info, th_index * sizeof(TH_INFO));
-        f.close();
-      }
-#ifdef DEBUG
-      Serial.println("SAVE H");
-#endif
-
-#ifdef DAILY_FILE
-      //  check if day changed
-      if (now.tm_mday != last.tm_mday) {
-        // gera nome do arquivo
-        strftime(buf, sizeof(buf), "/%d%m%Y.csv", &yesterday);
-        // write arquivo diario
-        dump_csv(buf, (th_index < 24) ? 0 : (th_index - 25));
-#ifdef DEBUG
-        Serial.println("SAVE D");
-#endif
-      }
-#endif
-
-      // check if month changed
-      if (now.tm_mon != last.tm_mon) {
-        // gera nome do arquivo
-        strftime(buf, sizeof(buf), "/%m%Y.csv", &yesterday);
-        // write arquivo mensal
-        dump_csv(buf, 0);
+    return false;
+  }
 
-        // reset data (move last entry to first)
-        th_info[0].tempo = th_info[th_index - 1].tempo;
-        th_info[0].temperature = th_info[th_index - 1].temperature;
-        th_info[0].humidity = th_info[th_index - 1].humidity;
+  // hourly sample, monthly files
+  logger.tick(time(NULL));
+  return false;
+}
 
-        th_index = 1;
-        SPIFFS.remove("/CACHE");
-#ifdef DEBUG
-        Serial.println("SAVE M");
-#endif
-      }
-    }
+bool task_export() {
+  // long job, yields when slice is over
+  if (!csv_export.busy()) {
+    return false;
   }
+  if (csv_export.run(&scheduler)) {
+    return true;
+  }
+  // new archive
+  csv_import.scan();
+  return false;
+}
+
+bool task_import() {
+  // long job, yields when slice is over
+  return csv_import.run(&scheduler);
+}
 
+void loop() {
+  scheduler.run();
   // loop end
-}
\ No newline at end of file
+}
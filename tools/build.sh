@@ -1,3 +1,10 @@
 #!/bin/bash
 gcc dump_cache.c -o dump_cache
-gcc trim_cache.c -o trim_cache
\ No newline at end of file
+gcc trim_cache.c -o trim_cache
+g++ -O2 -std=c++17 -pthread collector.cpp -o collector
+g++ -O2 -std=c++17 simulate.cpp -o simulate
+g++ -O2 -std=c++17 -DDAILY_FILE simulate.cpp -o simulate_daily
+g++ -O2 -std=c++17 -pthread loadtest.cpp -o loadtest
+g++ -O2 -std=c++17 gzbench.cpp -o gzbench -lz
+g++ -O2 -std=c++17 lowpower.cpp -o lowpower
+g++ -O2 -std=c++17 mqttsim.cpp -o mqttsim
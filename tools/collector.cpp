@@ -0,0 +1,1080 @@
+// collect history from many CLIMA stations into a columnar store
+//
+// collector [-d store] [-b broker[:port]] [-j threads] [-i seconds] [-1]
+//           [host[:port] ...]
+//   discover stations (SSDP) plus the given hosts, pull /CACHE and the
+//   monthly CSV archives of each one, listen to CLIMA/# on the broker
+//   (CLIMA/LIVE/<id> and CLIMA/BATCH/<id>, "time, t, h", and
+//   CLIMA/ALERT/<id>/<rule>; id is the SSDP serial number)
+//
+// collector query [-d store] [-s series] [-c] station from to
+//   from/to: unix time or YYYY-MM-DD[THH:MM[:SS]] (UTC)
+//
+// store layout (append only, one row per sample):
+//   <store>/<station>/<series>/<YYYYMM>/{time,temperature,humidity}.col
+//   series "hourly" comes from /CACHE, archives and CLIMA/BATCH (low power
+//   stations), "live" from CLIMA/LIVE
+// appends that fail are cut back. a rewritten partition gets new .tmp
+// columns, then a "commit" marker, then the renames: a crash before the
+// marker drops the .tmp files, after it the
+// renames are finished when the partition is next opened
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/csv_row.h"
+
+#define STORE_DIR "store"
+#define SSDP_ADDR "239.255.255.250"
+#define SSDP_PORT 1900
+#define SSDP_ST "urn:schemas-upnp-org:device:CLIMA:1"
+#define SSDP_WAIT 2000
+#define NET_TIMEOUT 5
+#define MQTT_PORT 1883
+#define MQTT_KEEPALIVE 60
+#define PULL_INTERVAL 300
+
+// stations run on <-03>3
+#define TZ_OFFSET (-3 * 3600)
+
+// same as CACHE entries (64 bit time_t)
+struct TH_INFO {
+  int64_t tempo;
+  float temperature;
+  float humidity;
+};
+
+struct Row {
+  int64_t t;
+  float temperature;
+  float humidity;
+  bool operator<(const Row &r) const { return t < r.t; }
+};
+
+std::atomic<bool> running(true);
+
+void report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void report(const char *fmt, ...) {
+  static std::mutex m;
+  char buf[32];
+  time_t t = time(NULL);
+  strftime(buf, sizeof(buf), "%F %T", localtime(&t));
+  std::lock_guard<std::mutex> l(m);
+  printf("%s ", buf);
+  va_list ap;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+  fflush(stdout);
+}
+
+/*
+store
+*/
+
+bool mkdirs(const std::string &path) {
+  for (size_t i = 1; i <= path.size(); i++) {
+    if ((i == path.size()) || (path[i] == '/')) {
+      std::string p = path.substr(0, i);
+      if (mkdir(p.c_str(), 0755) && (errno != EEXIST)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool file_exists(const std::string &path) {
+  struct stat st;
+  return !stat(path.c_str(), &st);
+}
+
+off_t file_size(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) ? 0 : st.st_size;
+}
+
+int month_of(int64_t t) {
+  time_t tt = t;
+  struct tm tm;
+  gmtime_r(&tt, &tm);
+  return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+int next_month(int m) { return (m % 100 == 12) ? (m / 100 + 1) * 100 + 1 : m + 1; }
+
+class Store {
+public:
+  Store(const std::string &dir) : dir(dir) {}
+
+  // append rows newer than what the partition already has, ok: false if
+  // some couldnt be written
+  size_t append(const std::string &station, const std::string &series,
+                std::vector<Row> rows, bool *ok = nullptr) {
+    std::lock_guard<std::mutex> l(lock(station));
+    std::sort(rows.begin(), rows.end());
+    size_t added = 0;
+    size_t i = 0;
+    while (i < rows.size()) {
+      // rows of one month
+      int m = month_of(rows[i].t);
+      size_t j = i;
+      while ((j < rows.size()) && (month_of(rows[j].t) == m)) {
+        j++;
+      }
+      std::string p = partition(station, series, m);
+      int64_t last = last_time(p);
+      std::vector<int64_t> t;
+      std::vector<float> temperature, humidity;
+      std::vector<Row> older;
+      for (; i < j; i++) {
+        if (rows[i].t > last) {
+          last = rows[i].t;
+          t.push_back(rows[i].t);
+          temperature.push_back(rows[i].temperature);
+          humidity.push_back(rows[i].humidity);
+        } else {
+          older.push_back(rows[i]);
+        }
+      }
+      bool done = !older.size() || merge(p, older, added);
+      if (t.size()) {
+        done = append_columns(p, t, temperature, humidity, last) && done;
+        added += done ? t.size() : 0;
+      }
+      if (!done && ok) {
+        *ok = false;
+      }
+    }
+    return added;
+  }
+
+  // rows with from <= t <= to, calls f for each
+  size_t query(const std::string &station, const std::string &series,
+               int64_t from, int64_t to,
+               const std::function<void(const Row &)> &f) {
+    size_t count = 0;
+    for (int m = month_of(from); m <= month_of(to); m = next_month(m)) {
+      std::string p = partition(station, series, m);
+      size_t n = rows(p);
+      if (!n) {
+        continue;
+      }
+      std::vector<int64_t> t(n);
+      if (!read(column(p, "time"), t.data(), 0, n)) {
+        continue;
+      }
+      size_t a = std::lower_bound(t.begin(), t.end(), from) - t.begin();
+      size_t b = std::upper_bound(t.begin(), t.end(), to) - t.begin();
+      if (a >= b) {
+        continue;
+      }
+      std::vector<float> temperature(b - a), humidity(b - a);
+      if (!read(column(p, "temperature"), temperature.data(), a, b - a) ||
+          !read(column(p, "humidity"), humidity.data(), a, b - a)) {
+        continue;
+      }
+      for (size_t i = a; i < b; i++) {
+        f(Row{t[i], temperature[i - a], humidity[i - a]});
+      }
+      count += b - a;
+    }
+    return count;
+  }
+
+  const std::string dir;
+
+private:
+  std::string partition(const std::string &station, const std::string &series,
+                        int month) {
+    return dir + "/" + station + "/" + series + "/" + std::to_string(month);
+  }
+
+  std::mutex &lock(const std::string &station) {
+    std::lock_guard<std::mutex> l(locks_lock);
+    std::unique_ptr<std::mutex> &m = locks[station];
+    if (!m) {
+      m.reset(new std::mutex);
+    }
+    return *m;
+  }
+
+  // column file to read: queries dont change the store (the daemon may be
+  // writing it), a committed rewrite not swapped in yet is read from .tmp
+  std::string column(const std::string &p, const char *c) {
+    std::string tmp = p + "/" + c + ".tmp";
+    return (file_exists(p + "/commit") && file_exists(tmp))
+               ? tmp
+               : p + "/" + c + ".col";
+  }
+
+  // complete rows (columns may differ after a crash, cut them)
+  size_t rows(const std::string &p) {
+    size_t n = file_size(column(p, "time")) / sizeof(int64_t);
+    n = std::min(n,
+                 (size_t)file_size(column(p, "temperature")) / sizeof(float));
+    n = std::min(n, (size_t)file_size(column(p, "humidity")) / sizeof(float));
+    return n;
+  }
+
+  // all columns or none: a failed write is cut back
+  bool append_columns(const std::string &p, const std::vector<int64_t> &t,
+                      const std::vector<float> &temperature,
+                      const std::vector<float> &humidity, int64_t last) {
+    static const char *cols[] = {"/time.col", "/temperature.col",
+                                 "/humidity.col"};
+    off_t size[3];
+    for (int i = 0; i < 3; i++) {
+      size[i] = file_size(p + cols[i]);
+    }
+    bool ok = mkdirs(p) && write(p + cols[0], t, "ab") &&
+              write(p + cols[1], temperature, "ab") &&
+              write(p + cols[2], humidity, "ab");
+    std::lock_guard<std::mutex> c(cache_lock);
+    if (ok) {
+      last_cache[p] = last;
+      return true;
+    }
+    for (int i = 0; i < 3; i++) {
+      if (truncate((p + cols[i]).c_str(), size[i])) {
+        // read it back (and cut it) next time
+        last_cache.erase(p);
+      }
+    }
+    return false;
+  }
+
+  int64_t last_time(const std::string &p) {
+    {
+      std::lock_guard<std::mutex> c(cache_lock);
+      auto i = last_cache.find(p);
+      if (i != last_cache.end()) {
+        return i->second;
+      }
+    }
+    recover(p);
+    int64_t last = INT64_MIN;
+    size_t n = rows(p);
+    if (n) {
+      truncate((p + "/time.col").c_str(), n * sizeof(int64_t));
+      truncate((p + "/temperature.col").c_str(), n * sizeof(float));
+      truncate((p + "/humidity.col").c_str(), n * sizeof(float));
+      read(p + "/time.col", &last, n - 1, 1);
+    }
+    std::lock_guard<std::mutex> c(cache_lock);
+    last_cache[p] = last;
+    return last;
+  }
+
+  // rows older than the partition end (archive of a month already seen),
+  // rare: rewrite the partition with the missing ones in place. false if
+  // it couldnt be written, added: rows that werent there
+  bool merge(const std::string &p, const std::vector<Row> &older,
+             size_t &added) {
+    size_t n = rows(p);
+    std::vector<int64_t> t(n);
+    std::vector<float> temperature(n), humidity(n);
+    if (!read(p + "/time.col", t.data(), 0, n) ||
+        !read(p + "/temperature.col", temperature.data(), 0, n) ||
+        !read(p + "/humidity.col", humidity.data(), 0, n)) {
+      return false;
+    }
+    std::vector<Row> all;
+    for (size_t i = 0; i < n; i++) {
+      all.push_back(Row{t[i], temperature[i], humidity[i]});
+    }
+    size_t missing = 0;
+    for (auto &r : older) {
+      if (!std::binary_search(t.begin(), t.end(), r.t)) {
+        all.push_back(r);
+        missing++;
+      }
+    }
+    if (!missing) {
+      return true;
+    }
+    std::stable_sort(all.begin(), all.end());
+    t.clear();
+    temperature.clear();
+    humidity.clear();
+    for (auto &r : all) {
+      t.push_back(r.t);
+      temperature.push_back(r.temperature);
+      humidity.push_back(r.humidity);
+    }
+    // write new columns, mark them complete, then swap them in
+    std::vector<char> mark(1, 1);
+    if (!write(p + "/time.tmp", t, "wb") ||
+        !write(p + "/temperature.tmp", temperature, "wb") ||
+        !write(p + "/humidity.tmp", humidity, "wb") ||
+        !write(p + "/commit.tmp", mark, "wb") ||
+        rename((p + "/commit.tmp").c_str(), (p + "/commit").c_str())) {
+      recover(p);
+      return false;
+    }
+    if (!recover(p)) {
+      return false;
+    }
+    added += missing;
+    return true;
+  }
+
+  // finish (marker there) or drop (no marker) an interrupted rewrite,
+  // false if columns couldnt be swapped in
+  bool recover(const std::string &p) {
+    static const char *cols[] = {"time", "temperature", "humidity"};
+    bool commit = file_exists(p + "/commit");
+    bool ok = true;
+    for (const char *c : cols) {
+      std::string tmp = p + "/" + c + ".tmp";
+      if (!file_exists(tmp)) {
+        continue;
+      }
+      if (!commit) {
+        unlink(tmp.c_str());
+      } else if (rename(tmp.c_str(), (p + "/" + c + ".col").c_str())) {
+        ok = false;
+      }
+    }
+    unlink((p + "/commit.tmp").c_str());
+    if (commit && ok) {
+      unlink((p + "/commit").c_str());
+    }
+    return ok;
+  }
+
+  template <class T>
+  bool write(const std::string &path, const std::vector<T> &v,
+             const char *mode) {
+    FILE *f = fopen(path.c_str(), mode);
+    if (!f) {
+      return false;
+    }
+    bool ok = fwrite(v.data(), sizeof(T), v.size(), f) == v.size();
+    return (fclose(f) == 0) && ok;
+  }
+
+  template <class T>
+  bool read(const std::string &path, T *v, size_t first, size_t n) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    ssize_t r = pread(fd, v, n * sizeof(T), first * sizeof(T));
+    close(fd);
+    return r == (ssize_t)(n * sizeof(T));
+  }
+
+  std::mutex locks_lock;
+  std::map<std::string, std::unique_ptr<std::mutex>> locks;
+  std::mutex cache_lock;
+  std::map<std::string, int64_t> last_cache;
+};
+
+/*
+thread pool
+*/
+
+class Pool {
+public:
+  Pool(int n) : active(0), stop(false) {
+    for (int i = 0; i < n; i++) {
+      workers.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> l(m);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+
+  void add(std::function<void()> f) {
+    {
+      std::lock_guard<std::mutex> l(m);
+      jobs.push(std::move(f));
+    }
+    cv.notify_one();
+  }
+
+  // till all queued jobs are done
+  void wait() {
+    std::unique_lock<std::mutex> l(m);
+    idle.wait(l, [this]() { return jobs.empty() && !active; });
+  }
+
+private:
+  void work() {
+    for (;;) {
+      std::function<void()> f;
+      {
+        std::unique_lock<std::mutex> l(m);
+        cv.wait(l, [this]() { return stop || !jobs.empty(); });
+        if (stop && jobs.empty()) {
+          return;
+        }
+        f = std::move(jobs.front());
+        jobs.pop();
+        active++;
+      }
+      f();
+      {
+        std::lock_guard<std::mutex> l(m);
+        active--;
+      }
+      idle.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> jobs;
+  std::mutex m;
+  std::condition_variable cv, idle;
+  int active;
+  bool stop;
+};
+
+/*
+network
+*/
+
+void split_host(const std::string &s, std::string &host, int &port,
+                int default_port) {
+  size_t c = s.rfind(':');
+  host = (c == std::string::npos) ? s : s.substr(0, c);
+  port = (c == std::string::npos) ? default_port : atoi(s.c_str() + c + 1);
+}
+
+int tcp_connect(const std::string &host, int port) {
+  struct addrinfo hints = {}, *res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res)) {
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, 0);
+  if (fd >= 0) {
+    struct timeval tv = {NET_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, res->ai_addr, res->ai_addrlen)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+bool send_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len) {
+    ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+    if (w <= 0) {
+      return false;
+    }
+    p += w;
+    len -= w;
+  }
+  return true;
+}
+
+bool recv_all(int fd, void *buf, size_t len) {
+  char *p = (char *)buf;
+  while (len) {
+    ssize_t r = recv(fd, p, len, 0);
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    len -= r;
+  }
+  return true;
+}
+
+std::string dechunk(const std::string &s) {
+  std::string out;
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t e = s.find("\r\n", i);
+    if (e == std::string::npos) {
+      break;
+    }
+    size_t n = strtoul(s.c_str() + i, NULL, 16);
+    if (!n) {
+      break;
+    }
+    out.append(s, e + 2, n);
+    i = e + 2 + n + 2;
+  }
+  return out;
+}
+
+// HTTP/1.0 GET, body of a 200 reply
+bool http_get(const std::string &station, const std::string &path,
+              std::string &body) {
+  std::string host;
+  int port;
+  split_host(station, host, port, 80);
+  int fd = tcp_connect(host, port);
+  if (fd < 0) {
+    return false;
+  }
+  std::string req = "GET " + path + " HTTP/1.0\r\nHost: " + host +
+                    "\r\nConnection: close\r\n\r\n";
+  std::string reply;
+  if (send_all(fd, req.data(), req.size())) {
+    char buf[4096];
+    ssize_t r;
+    while ((r = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      reply.append(buf, r);
+    }
+  }
+  close(fd);
+  size_t e = reply.find("\r\n\r\n");
+  if ((e == std::string::npos) || (reply.compare(0, 5, "HTTP/") != 0) ||
+      (reply.find(" 200") != reply.find(' '))) {
+    return false;
+  }
+  std::string headers = reply.substr(0, e);
+  body = reply.substr(e + 4);
+  std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+  if (headers.find("transfer-encoding: chunked") != std::string::npos) {
+    body = dechunk(body);
+  } else if ((e = headers.find("content-length:")) != std::string::npos) {
+    // connection dropped
+    return body.size() == strtoul(headers.c_str() + e + 15, NULL, 10);
+  }
+  return true;
+}
+
+// SSDP M-SEARCH, host:port of every CLIMA that answers
+std::set<std::string> discover() {
+  std::set<std::string> found;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return found;
+  }
+  struct sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(SSDP_PORT);
+  inet_pton(AF_INET, SSDP_ADDR, &to.sin_addr);
+  const char msg[] = "M-SEARCH * HTTP/1.1\r\n"
+                     "HOST: " SSDP_ADDR ":1900\r\n"
+                     "MAN: \"ssdp:discover\"\r\n"
+                     "MX: 1\r\n"
+                     "ST: " SSDP_ST "\r\n\r\n";
+  sendto(fd, msg, sizeof(msg) - 1, 0, (struct sockaddr *)&to, sizeof(to));
+
+  auto end = std::chrono::steady_clock::now() +
+             std::chrono::milliseconds(SSDP_WAIT);
+  for (;;) {
+    int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   end - std::chrono::steady_clock::now())
+                   .count();
+    struct pollfd p = {fd, POLLIN, 0};
+    if ((left <= 0) || (poll(&p, 1, left) <= 0)) {
+      break;
+    }
+    char buf[1024];
+    ssize_t r = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (r <= 0) {
+      continue;
+    }
+    buf[r] = 0;
+    // LOCATION: http://host:port/description.xml
+    std::string s = buf;
+    std::string l = s;
+    std::transform(l.begin(), l.end(), l.begin(), ::tolower);
+    size_t i = l.find("location:");
+    if (l.find("clima") == std::string::npos) {
+      continue;
+    }
+    if (i != std::string::npos) {
+      i = l.find("http://", i);
+      if (i != std::string::npos) {
+        i += 7;
+        size_t e = s.find_first_of("/\r\n", i);
+        found.insert(s.substr(i, e - i));
+      }
+    }
+  }
+  close(fd);
+  return found;
+}
+
+/*
+stations
+*/
+
+struct Station {
+  std::string host;
+  std::string id;
+  std::set<std::string> archives;
+};
+
+std::string xml_value(const std::string &xml, const std::string &tag) {
+  size_t i = xml.find("<" + tag + ">");
+  if (i == std::string::npos) {
+    return "";
+  }
+  i += tag.size() + 2;
+  return xml.substr(i, xml.find('<', i) - i);
+}
+
+std::string clean(std::string s) {
+  for (auto &c : s) {
+    if (!isalnum((unsigned char)c) && (c != '-') && (c != '.')) {
+      c = '_';
+    }
+  }
+  return s;
+}
+
+// CSV line from dump_csv(), station time zone
+bool parse_csv_line(const char *s, Row &r) {
+  struct tm tm;
+  if (!csv_row_scan(s, tm, r.temperature, r.humidity)) {
+    return false;
+  }
+  r.t = timegm(&tm) - TZ_OFFSET;
+  return true;
+}
+
+std::vector<Row> parse_csv(const std::string &s) {
+  std::vector<Row> rows;
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t e = s.find('\n', i);
+    if (e == std::string::npos) {
+      e = s.size();
+    }
+    Row r;
+    if (parse_csv_line(s.substr(i, e - i).c_str(), r)) {
+      rows.push_back(r);
+    }
+    i = e + 1;
+  }
+  return rows;
+}
+
+std::vector<Row> parse_cache(const std::string &s) {
+  std::vector<Row> rows;
+  for (size_t i = 0; i + sizeof(TH_INFO) <= s.size(); i += sizeof(TH_INFO)) {
+    TH_INFO e;
+    memcpy(&e, s.data() + i, sizeof(e));
+    rows.push_back(Row{e.tempo, e.temperature, e.humidity});
+  }
+  return rows;
+}
+
+void load_archives(Store &store, Station &s) {
+  FILE *f = fopen((store.dir + "/" + s.id + "/archives").c_str(), "r");
+  if (f) {
+    char buf[256];
+    while (fgets(buf, sizeof(buf), f)) {
+      buf[strcspn(buf, "\r\n")] = 0;
+      s.archives.insert(buf);
+    }
+    fclose(f);
+  }
+}
+
+void save_archive(Store &store, Station &s, const std::string &name) {
+  s.archives.insert(name);
+  mkdirs(store.dir + "/" + s.id);
+  FILE *f = fopen((store.dir + "/" + s.id + "/archives").c_str(), "a");
+  if (f) {
+    fprintf(f, "%s\n", name.c_str());
+    fclose(f);
+  }
+}
+
+void pull(Store &store, Station &s) {
+  auto start = std::chrono::steady_clock::now();
+  std::string body;
+
+  // station id from SSDP description
+  if (s.id.empty()) {
+    std::string serial;
+    if (http_get(s.host, "/description.xml", body)) {
+      serial = xml_value(body, "serialNumber");
+    }
+    s.id = clean(serial.empty() ? s.host : serial);
+    load_archives(store, s);
+  }
+
+  // current month
+  size_t added = 0;
+  if (!http_get(s.host, "/files?n=/CACHE", body)) {
+    report("%s (%s): unreachable", s.id.c_str(), s.host.c_str());
+    return;
+  }
+  added += store.append(s.id, "hourly", parse_cache(body));
+
+  // monthly archives, once: only when whole (listed size) and stored
+  std::string dir;
+  if (http_get(s.host, "/files", dir)) {
+    size_t i = 0;
+    while ((i = dir.find("files?n=", i)) != std::string::npos) {
+      i += 8;
+      std::string name = dir.substr(i, dir.find_first_of("'\"", i) - i);
+      // "...>name</a>    (size)"
+      size_t l = dir.find("</a>", i);
+      l = (l == std::string::npos) ? l : dir.find('(', l);
+      if ((name.size() > 4) &&
+          (name.compare(name.size() - 4, 4, ".csv") == 0) &&
+          !s.archives.count(name) && (l != std::string::npos) &&
+          http_get(s.host, "/files?n=" + name, body) &&
+          (body.size() == strtoul(dir.c_str() + l + 1, NULL, 10))) {
+        bool ok = true;
+        added += store.append(s.id, "hourly", parse_csv(body), &ok);
+        if (ok) {
+          save_archive(store, s, name);
+        }
+      }
+    }
+  }
+
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  report("%s (%s): %zu new rows, %lld ms", s.id.c_str(), s.host.c_str(), added,
+      (long long)ms);
+}
+
+/*
+mqtt
+*/
+
+void mqtt_string(std::string &p, const std::string &s) {
+  p += (char)(s.size() >> 8);
+  p += (char)(s.size() & 0xff);
+  p += s;
+}
+
+bool mqtt_send(int fd, uint8_t type, const std::string &payload) {
+  std::string p(1, (char)type);
+  size_t n = payload.size();
+  do {
+    uint8_t b = n % 128;
+    n /= 128;
+    p += (char)(n ? (b | 0x80) : b);
+  } while (n);
+  p += payload;
+  return send_all(fd, p.data(), p.size());
+}
+
+bool mqtt_recv(int fd, uint8_t &type, std::string &payload) {
+  uint8_t b;
+  if (!recv_all(fd, &type, 1)) {
+    return false;
+  }
+  size_t n = 0, mul = 1;
+  do {
+    if (!recv_all(fd, &b, 1)) {
+      return false;
+    }
+    n += (b & 0x7f) * mul;
+    mul *= 128;
+  } while (b & 0x80);
+  payload.resize(n);
+  return !n || recv_all(fd, &payload[0], n);
+}
+
+// "time, t, h" from CLIMA/LIVE/<id> or CLIMA/BATCH/<id>
+bool parse_sample(const std::string &s, Row &r) {
+  long long t;
+  if (sscanf(s.c_str(), "%lld, %f, %f", &t, &r.temperature, &r.humidity) !=
+      3) {
+    return false;
+  }
+  r.t = t;
+  return true;
+}
+
+// only the per station topics are stored: CLIMA/TEMPERATURE and
+// CLIMA/HUMIDITY are shared, messages of several stations interleave
+void mqtt_run(const std::string &broker, Store &store) {
+  std::string host;
+  int port;
+  split_host(broker, host, port, MQTT_PORT);
+  while (running) {
+    int fd = tcp_connect(host, port);
+    if (fd < 0) {
+      report("mqtt: cant connect to %s", broker.c_str());
+      sleep(NET_TIMEOUT);
+      continue;
+    }
+
+    // CONNECT (3.1.1, clean session), SUBSCRIBE CLIMA/#
+    std::string p;
+    mqtt_string(p, "MQTT");
+    p += (char)4;
+    p += (char)2;
+    p += (char)(MQTT_KEEPALIVE >> 8);
+    p += (char)(MQTT_KEEPALIVE & 0xff);
+    mqtt_string(p, "clima-collector-" + std::to_string(getpid()));
+    uint8_t type;
+    std::string r;
+    bool ok = mqtt_send(fd, 0x10, p) && mqtt_recv(fd, type, r) &&
+              (type == 0x20) && (r.size() == 2) && !r[1];
+    p = std::string("\0\1", 2);
+    mqtt_string(p, "CLIMA/#");
+    p += (char)0;
+    ok = ok && mqtt_send(fd, 0x82, p);
+    if (ok) {
+      report("mqtt: connected to %s", broker.c_str());
+    }
+
+    auto ping = std::chrono::steady_clock::now();
+    while (ok && running) {
+      struct pollfd pf = {fd, POLLIN, 0};
+      int n = poll(&pf, 1, 1000);
+      if (std::chrono::steady_clock::now() - ping >
+          std::chrono::seconds(MQTT_KEEPALIVE / 2)) {
+        ping = std::chrono::steady_clock::now();
+        ok = mqtt_send(fd, 0xc0, "");
+      }
+      if (n <= 0) {
+        continue;
+      }
+      if (!(ok = mqtt_recv(fd, type, r))) {
+        break;
+      }
+      if ((type & 0xf0) != 0x30 || (r.size() < 2)) {
+        continue;
+      }
+      // PUBLISH: topic, [packet id], payload
+      size_t tl = ((uint8_t)r[0] << 8) | (uint8_t)r[1];
+      if (r.size() < 2 + tl) {
+        continue;
+      }
+      std::string topic = r.substr(2, tl);
+      std::string value = r.substr(2 + tl + ((type & 0x06) ? 2 : 0));
+      Row row;
+      if ((topic.compare(0, 11, "CLIMA/LIVE/") == 0) && (topic.size() > 11)) {
+        if (parse_sample(value, row)) {
+          store.append(clean(topic.substr(11)), "live", std::vector<Row>{row});
+        }
+      } else if ((topic.compare(0, 12, "CLIMA/BATCH/") == 0) &&
+                 (topic.size() > 12)) {
+        if (parse_sample(value, row)) {
+          store.append(clean(topic.substr(12)), "hourly",
+                       std::vector<Row>{row});
+        }
+      } else if (topic.compare(0, 12, "CLIMA/ALERT/") == 0) {
+        // CLIMA/ALERT/<id>/<rule>
+        size_t k = topic.find('/', 12);
+        if (k != std::string::npos) {
+          report("%s: alert %s %s", clean(topic.substr(12, k - 12)).c_str(),
+                 topic.c_str() + k + 1, value.c_str());
+        }
+      }
+    }
+    close(fd);
+    report("mqtt: disconnected");
+    sleep(1);
+  }
+}
+
+/*
+main
+*/
+
+int64_t parse_time(const char *s) {
+  struct tm tm = {};
+  if (strchr(s, '-')) {
+    int n = sscanf(s, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon,
+                   &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n < 3) {
+      return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    return timegm(&tm);
+  }
+  return atoll(s);
+}
+
+void usage() {
+  fprintf(stderr,
+          "collector [-d store] [-b broker[:port]] [-j threads] "
+          "[-i seconds] [-1] [host[:port] ...]\n"
+          "collector query [-d store] [-s series] [-c] station from to\n");
+  exit(1);
+}
+
+int query(int argc, char *argv[]) {
+  std::string dir = STORE_DIR, series = "hourly";
+  bool stats = false;
+  int c;
+  while ((c = getopt(argc, argv, "d:s:c")) != -1) {
+    switch (c) {
+    case 'd':
+      dir = optarg;
+      break;
+    case 's':
+      series = optarg;
+      break;
+    case 'c':
+      stats = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 3) {
+    usage();
+  }
+  int64_t from = parse_time(argv[optind + 1]);
+  int64_t to = parse_time(argv[optind + 2]);
+  if ((from < 0) || (to < from)) {
+    usage();
+  }
+
+  Store store(dir);
+  float tmin = 1e9, tmax = -1e9, hmin = 1e9, hmax = -1e9;
+  double tsum = 0, hsum = 0;
+  auto start = std::chrono::steady_clock::now();
+  size_t n = store.query(argv[optind], series, from, to, [&](const Row &r) {
+    if (stats) {
+      tmin = std::min(tmin, r.temperature);
+      tmax = std::max(tmax, r.temperature);
+      hmin = std::min(hmin, r.humidity);
+      hmax = std::max(hmax, r.humidity);
+      tsum += r.temperature;
+      hsum += r.humidity;
+    } else {
+      char buf[32];
+      time_t t = r.t;
+      strftime(buf, sizeof(buf), "%FT%TZ", gmtime(&t));
+      printf("%s, %.01f, %.01f\n", buf, r.temperature, r.humidity);
+    }
+  });
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  if (stats && n) {
+    printf("rows %zu\ntemperature min %.01f max %.01f mean %.02f\n"
+           "humidity min %.01f max %.01f mean %.02f\n",
+           n, tmin, tmax, tsum / n, hmin, hmax, hsum / n);
+  }
+  fprintf(stderr, "%zu rows in %lld us\n", n, (long long)us);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if ((argc > 1) && !strcmp(argv[1], "query")) {
+    return query(argc - 1, argv + 1);
+  }
+
+  std::string dir = STORE_DIR, broker;
+  int threads = std::thread::hardware_concurrency();
+  int interval = PULL_INTERVAL;
+  bool once = false;
+  int c;
+  while ((c = getopt(argc, argv, "d:b:j:i:1")) != -1) {
+    switch (c) {
+    case 'd':
+      dir = optarg;
+      break;
+    case 'b':
+      broker = optarg;
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    case '1':
+      once = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  signal(SIGINT, [](int) { running = false; });
+  signal(SIGTERM, [](int) { running = false; });
+
+  Store store(dir);
+  Pool pool(threads);
+  std::map<std::string, Station> stations;
+  for (int i = optind; i < argc; i++) {
+    stations[argv[i]].host = argv[i];
+  }
+
+  std::thread mqtt;
+  if (!broker.empty()) {
+    mqtt = std::thread(mqtt_run, broker, std::ref(store));
+  }
+
+  while (running) {
+    for (auto &h : discover()) {
+      if (!stations.count(h)) {
+        report("found %s", h.c_str());
+        stations[h].host = h;
+      }
+    }
+
+    // one job per station, in parallel
+    for (auto &s : stations) {
+      Station *st = &s.second;
+      pool.add([&store, st]() { pull(store, *st); });
+    }
+    pool.wait();
+
+    if (once) {
+      break;
+    }
+    for (int i = 0; (i < interval) && running; i++) {
+      sleep(1);
+    }
+  }
+
+  running = false;
+  if (mqtt.joinable()) {
+    mqtt.join();
+  }
+  return 0;
+}
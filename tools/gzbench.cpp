@@ -0,0 +1,164 @@
+// compression ratio and cost of the streaming gzip encoder (include/gzip.h)
+//
+// gzbench [-n runs] [-w write] [file ...]
+//   -n  timing runs per file, best one is reported (default 20)
+//   -w  bytes per write() call, like the www pages do (default 512)
+//
+// without files it benchmarks a month of CSV made by CsvExport. every
+// output is checked by inflating it back with zlib, whose level 1 and 6
+// ratios are printed for reference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "host/mem_storage.h"
+
+#include "../include/csv_export.h"
+#include "../include/gzip.h"
+
+unsigned long sched_millis() { return 0; }
+unsigned long sched_micros() { return 0; }
+
+void collect(const uint8_t *data, size_t len, void *arg) {
+  ((std::string *)arg)->append((const char *)data, len);
+}
+
+std::string gzip(const std::string &in, size_t step) {
+  std::string out;
+  Gzip gz(collect, &out);
+  for (size_t i = 0; i < in.size(); i += step) {
+    gz.write(in.data() + i, std::min(step, in.size() - i));
+  }
+  gz.finish();
+  return out;
+}
+
+bool gunzip(const std::string &in, std::string &out) {
+  z_stream z = {};
+  if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  z.next_in = (Bytef *)in.data();
+  z.avail_in = in.size();
+  char buf[4096];
+  int r;
+  do {
+    z.next_out = (Bytef *)buf;
+    z.avail_out = sizeof(buf);
+    r = inflate(&z, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - z.avail_out);
+  } while (r == Z_OK);
+  inflateEnd(&z);
+  return (r == Z_STREAM_END) && !z.avail_in;
+}
+
+size_t zlib_size(const std::string &in, int level) {
+  z_stream z = {};
+  deflateInit2(&z, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  std::vector<Bytef> out(deflateBound(&z, in.size()));
+  z.next_in = (Bytef *)in.data();
+  z.avail_in = in.size();
+  z.next_out = out.data();
+  z.avail_out = out.size();
+  deflate(&z, Z_FINISH);
+  size_t n = z.total_out;
+  deflateEnd(&z);
+  return n;
+}
+
+void bench(const char *name, const std::string &in, int runs, size_t step) {
+  double best = 1e9;
+  std::string out;
+  for (int i = 0; i < runs; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    out = gzip(in, step);
+    double us = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count();
+    best = std::min(best, us);
+  }
+  std::string back;
+  bool ok = gunzip(out, back) && (back == in);
+  printf("%s\t%zu\t%zu\t%.2f\t%.1f\t%.2f\t%.2f\t%s\n", name, in.size(),
+         out.size(), in.size() ? (double)in.size() / out.size() : 0.0,
+         in.size() ? best / (in.size() / 1024.0) : 0.0,
+         in.size() ? (double)in.size() / zlib_size(in, 1) : 0.0,
+         in.size() ? (double)in.size() / zlib_size(in, 6) : 0.0,
+         ok ? "ok" : "BAD");
+  if (!ok) {
+    exit(1);
+  }
+}
+
+// a month of hourly samples as exported by the device
+std::string sample_csv() {
+  MemStorage storage;
+  CsvExport csv_export(storage);
+  setenv("TZ", "<-03>3", 1);
+  tzset();
+  srand(1);
+  time_t t = 1704078000;
+  for (int i = 0; i < 24 * 31; i++, t += 3600) {
+    TH_INFO e = {t, 20 + (rand() % 100) / 10.0f, 50 + (rand() % 200) / 10.0f};
+    storage.append("/MONTH", &e, sizeof(e));
+  }
+  csv_export.add("/MONTH", 0, 24 * 31, "/012024.csv", true);
+  csv_export.run();
+  return storage.files["/012024.csv"];
+}
+
+void usage() {
+  fprintf(stderr, "gzbench [-n runs] [-w write] [file ...]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int runs = 20;
+  size_t step = 512;
+  int c;
+  while ((c = getopt(argc, argv, "n:w:")) != -1) {
+    switch (c) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'w':
+      step = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((runs < 1) || (step < 1)) {
+    usage();
+  }
+
+  printf("# encoder RAM: %zu bytes\n", sizeof(Gzip));
+  printf("# file\tbytes\tgzip\tratio\tus/KB\tzlib-1\tzlib-6\tcheck\n");
+  if (optind == argc) {
+    bench("012024.csv", sample_csv(), runs, step);
+  }
+  for (int i = optind; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (!f) {
+      fprintf(stderr, "Cant open %s\n", argv[i]);
+      return 1;
+    }
+    std::string in;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      in.append(buf, n);
+    }
+    fclose(f);
+    bench(argv[i], in, runs, step);
+  }
+  return 0;
+}
@@ -0,0 +1,40 @@
+// just enough of Arduino.h to build the www pages on a PC
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#define PROGMEM
+#define PSTR(S) (S)
+#define snprintf_P snprintf
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+class String {
+public:
+  String() {}
+  String(const char *s) : s(s ? s : "") {}
+  String(const std::string &s) : s(s) {}
+
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.size(); }
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  bool operator==(const char *o) const { return s == o; }
+  bool operator!=(const char *o) const { return s != o; }
+  String &operator+=(const String &o) {
+    s += o.s;
+    return *this;
+  }
+  String operator+(const String &o) const { return String(s + o.s); }
+
+private:
+  std::string s;
+};
+
+#endif
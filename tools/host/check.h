@@ -0,0 +1,77 @@
+// checks shared by the simulators: error report, CSV and CACHE readers
+
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include "../../include/csv_row.h"
+#include "../../include/history.h"
+
+inline int errors;
+
+// count it, print the first 20
+void error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+inline void error(const char *fmt, ...) {
+  if (errors++ < 20) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("ERROR: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+  }
+}
+
+// CSV row, local time
+inline bool parse_row(const char *s, TH_INFO &e) {
+  struct tm tm;
+  if (!csv_row_scan(s, tm, e.temperature, e.humidity)) {
+    return false;
+  }
+  e.tempo = mktime(&tm);
+  return true;
+}
+
+// every entry of a CACHE image
+template <typename F> void cache_entries(const std::string &data, F f) {
+  for (size_t i = 0; i + sizeof(TH_INFO) <= data.size();
+       i += sizeof(TH_INFO)) {
+    TH_INFO e;
+    memcpy(&e, data.data() + i, sizeof(e));
+    f(e);
+  }
+}
+
+// every row of a CSV file (header skipped), must be whole, parse and be in
+// time order
+template <typename F>
+void csv_rows(const std::string &data, const char *name, F f) {
+  time_t prev = 0;
+  size_t i = data.find('\n') + 1;
+  while (i < data.size()) {
+    size_t e = data.find('\n', i);
+    if (e == std::string::npos) {
+      error("%s: truncated", name);
+      return;
+    }
+    TH_INFO row;
+    if (!parse_row(data.substr(i, e - i).c_str(), row)) {
+      error("%s: bad row", name);
+      return;
+    }
+    if (row.tempo <= prev) {
+      error("%s: rows out of order", name);
+    }
+    prev = row.tempo;
+    f(row);
+    i = e + 1;
+  }
+}
+
+#endif
@@ -0,0 +1,89 @@
+// Storage in RAM, counts calls and bytes
+
+#ifndef HOST_MEM_STORAGE_H
+#define HOST_MEM_STORAGE_H
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "../../include/storage.h"
+
+class MemStorage : public Storage {
+public:
+  bool exists(const char *path) { return files.count(path); }
+
+  size_t size(const char *path) {
+    auto f = files.find(path);
+    return (f == files.end()) ? 0 : f->second.size();
+  }
+
+  size_t read(const char *path, size_t offset, void *buf, size_t len) {
+    reads++;
+    auto f = files.find(path);
+    if ((f == files.end()) || (offset >= f->second.size())) {
+      return 0;
+    }
+    len = std::min(len, f->second.size() - offset);
+    memcpy(buf, f->second.data() + offset, len);
+    bytes_read += len;
+    return len;
+  }
+
+  size_t append(const char *path, const void *buf, size_t len) {
+    appends++;
+    bytes_written += len;
+    files[path].append((const char *)buf, len);
+    return len;
+  }
+
+  bool remove(const char *path) {
+    removes++;
+    return files.erase(path);
+  }
+
+  bool rename(const char *from, const char *to) {
+    renames++;
+    auto f = files.find(from);
+    if (f == files.end()) {
+      return false;
+    }
+    files[to] = f->second;
+    files.erase(from);
+    return true;
+  }
+
+  void list(list_fn f, void *arg) {
+    for (auto &i : files) {
+      f(i.first.c_str(), i.second.size(), 0, arg);
+    }
+  }
+
+  size_t stream(const char *path, void *buf, size_t len, chunk_fn f,
+                void *arg) {
+    size_t total = 0, r;
+    while ((r = read(path, total, buf, len))) {
+      f((const uint8_t *)buf, r, arg);
+      total += r;
+    }
+    return total;
+  }
+
+  bool info(size_t &total, size_t &used) {
+    total = capacity;
+    used = 0;
+    for (auto &i : files) {
+      used += i.second.size();
+    }
+    return true;
+  }
+
+  std::map<std::string, std::string> files;
+  size_t capacity = 2 * 1024 * 1024;
+  unsigned long long bytes_written = 0, bytes_read = 0;
+  unsigned long appends = 0, reads = 0, removes = 0, renames = 0;
+};
+
+#endif
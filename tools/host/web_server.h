@@ -0,0 +1,336 @@
+// ESP8266WebServer stand-in on POSIX sockets
+//
+// one client at a time, like the device: accept, read the request, run the
+// handler, send the last chunk and close. send()/sendContent() map to
+// socket writes the same way the ESP8266 library does (headers in one
+// write, one chunk per sendContent).
+
+#ifndef HOST_WEB_SERVER_H
+#define HOST_WEB_SERVER_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "arduino.h"
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST };
+
+class WiFiClient {
+public:
+  WiFiClient(int fd = -1) : fd(fd) {}
+
+  size_t write(const uint8_t *buf, size_t len) {
+    return (fd >= 0) ? ::send(fd, buf, len, MSG_NOSIGNAL) : 0;
+  }
+  size_t write(const char *buf, size_t len) {
+    return write((const uint8_t *)buf, len);
+  }
+  size_t print(const char *s) { return write(s, strlen(s)); }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[2048];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return write(buf, std::min((size_t)n, sizeof(buf) - 1));
+  }
+
+private:
+  int fd;
+};
+
+class ESP8266WebServer {
+public:
+  typedef std::function<void()> THandlerFunction;
+
+  ESP8266WebServer(int port = 80) : port(port), fd(-1), cfd(-1) {}
+
+  ~ESP8266WebServer() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  bool begin(int p) {
+    port = p;
+    return begin();
+  }
+
+  bool begin() {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in a = {};
+    a.sin_family = AF_INET;
+    a.sin_port = htons(port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)) || listen(fd, 128)) {
+      close(fd);
+      fd = -1;
+      return false;
+    }
+    return true;
+  }
+
+  void on(const char *uri, THandlerFunction f) { on(uri, HTTP_ANY, f); }
+  void on(const char *uri, HTTPMethod, THandlerFunction f) {
+    handlers[uri] = f;
+  }
+  void onNotFound(THandlerFunction f) { not_found = f; }
+
+  void collectHeaders(const char *names[], size_t count) {
+    collect.clear();
+    for (size_t i = 0; i < count; i++) {
+      collect.push_back(lower(names[i]));
+    }
+  }
+
+  // serve one request (if there's one within 10 ms)
+  void handleClient() {
+    struct pollfd p = {fd, POLLIN, 0};
+    if ((fd < 0) || (poll(&p, 1, 10) <= 0)) {
+      return;
+    }
+    cfd = accept(fd, NULL, NULL);
+    if (cfd < 0) {
+      return;
+    }
+    int one = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (parse()) {
+      content_length = CONTENT_LENGTH_NOT_SET;
+      chunked = false;
+      auto h = handlers.find(path);
+      if (h != handlers.end()) {
+        h->second();
+      } else if (not_found) {
+        not_found();
+      }
+      if (chunked) {
+        // last chunk
+        raw("0\r\n\r\n", 5);
+      }
+    }
+    close(cfd);
+    cfd = -1;
+  }
+
+  void setContentLength(size_t len) { content_length = len; }
+
+  void sendHeader(const char *name, const char *value) {
+    extra_headers += std::string(name) + ": " + value + "\r\n";
+  }
+
+  void send(int code, const char *type, const char *content, size_t len) {
+    std::string h = "HTTP/1.1 " + std::to_string(code) + " " + reason(code) +
+                    "\r\nContent-Type: " + type + "\r\n";
+    if (content_length == CONTENT_LENGTH_NOT_SET) {
+      content_length = len;
+    }
+    if (content_length == CONTENT_LENGTH_UNKNOWN) {
+      chunked = http11;
+      if (chunked) {
+        h += "Transfer-Encoding: chunked\r\n";
+      }
+    } else {
+      h += "Content-Length: " + std::to_string(content_length) + "\r\n";
+    }
+    h += extra_headers + "Connection: close\r\n\r\n";
+    extra_headers.clear();
+    raw(h.data(), h.size());
+    if (len) {
+      sendContent(content, len);
+    }
+  }
+  void send(int code, const char *type, const char *content) {
+    send(code, type, content, strlen(content));
+  }
+  void send(int code, const char *type, const String &content) {
+    send(code, type, content.c_str(), content.length());
+  }
+  void send(int code) { send(code, "text/plain", "", 0); }
+  void send_P(int code, const char *type, const char *content) {
+    send(code, type, content);
+  }
+  void send_P(int code, const char *type, const char *content, size_t len) {
+    send(code, type, content, len);
+  }
+
+  void sendContent(const char *content, size_t len) {
+    if (chunked) {
+      char size[16];
+      int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+      raw(size, n);
+      raw(content, len);
+      raw("\r\n", 2);
+    } else {
+      raw(content, len);
+    }
+  }
+  void sendContent(const char *content) { sendContent(content, strlen(content)); }
+  void sendContent(const String &content) {
+    sendContent(content.c_str(), content.length());
+  }
+  void sendContent_P(const char *content) { sendContent(content); }
+  void sendContent_P(const char *content, size_t len) {
+    sendContent(content, len);
+  }
+
+  bool hasArg(const char *name) const { return args.count(name); }
+  String arg(const char *name) const {
+    auto a = args.find(name);
+    return (a == args.end()) ? String() : String(a->second);
+  }
+  bool hasHeader(const char *name) const { return headers.count(lower(name)); }
+  String header(const char *name) const {
+    auto h = headers.find(lower(name));
+    return (h == headers.end()) ? String() : String(h->second);
+  }
+  String uri() const { return String(path); }
+  HTTPMethod method() const { return request_method; }
+
+  WiFiClient client() { return WiFiClient(cfd); }
+
+private:
+  static std::string lower(std::string s) {
+    for (auto &c : s) {
+      c = tolower(c);
+    }
+    return s;
+  }
+
+  static const char *reason(int code) {
+    switch (code) {
+    case 200:
+      return "OK";
+    case 304:
+      return "Not Modified";
+    case 404:
+      return "Not Found";
+    default:
+      return "";
+    }
+  }
+
+  static std::string decode(const std::string &s) {
+    std::string o;
+    for (size_t i = 0; i < s.size(); i++) {
+      if ((s[i] == '%') && (i + 2 < s.size())) {
+        o += (char)strtol(s.substr(i + 1, 2).c_str(), NULL, 16);
+        i += 2;
+      } else {
+        o += (s[i] == '+') ? ' ' : s[i];
+      }
+    }
+    return o;
+  }
+
+  void raw(const char *buf, size_t len) {
+    while (len) {
+      ssize_t w = ::send(cfd, buf, len, MSG_NOSIGNAL);
+      if (w <= 0) {
+        return;
+      }
+      buf += w;
+      len -= w;
+    }
+  }
+
+  // request line, headers and query args
+  bool parse() {
+    std::string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+      ssize_t r = recv(cfd, buf, sizeof(buf), 0);
+      if ((r <= 0) || (req.size() > 8192)) {
+        return false;
+      }
+      req.append(buf, r);
+    }
+    size_t e = req.find("\r\n");
+    std::string line = req.substr(0, e);
+    size_t a = line.find(' '), b = line.rfind(' ');
+    if ((a == std::string::npos) || (a == b)) {
+      return false;
+    }
+    std::string m = line.substr(0, a);
+    request_method = (m == "GET")    ? HTTP_GET
+                     : (m == "POST") ? HTTP_POST
+                     : (m == "HEAD") ? HTTP_HEAD
+                                     : HTTP_ANY;
+    std::string target = line.substr(a + 1, b - a - 1);
+    http11 = line.compare(b + 1, std::string::npos, "HTTP/1.1") == 0;
+
+    args.clear();
+    size_t q = target.find('?');
+    path = target.substr(0, q);
+    if (q != std::string::npos) {
+      std::string query = target.substr(q + 1);
+      size_t i = 0;
+      while (i <= query.size()) {
+        size_t amp = query.find('&', i);
+        if (amp == std::string::npos) {
+          amp = query.size();
+        }
+        std::string kv = query.substr(i, amp - i);
+        size_t eq = kv.find('=');
+        if (kv.size()) {
+          args[decode(kv.substr(0, eq))] =
+              (eq == std::string::npos) ? "" : decode(kv.substr(eq + 1));
+        }
+        i = amp + 1;
+      }
+    }
+
+    headers.clear();
+    size_t i = e + 2;
+    while (i < req.size()) {
+      size_t n = req.find("\r\n", i);
+      if ((n == std::string::npos) || (n == i)) {
+        break;
+      }
+      std::string h = req.substr(i, n - i);
+      size_t c = h.find(':');
+      if (c != std::string::npos) {
+        std::string name = lower(h.substr(0, c));
+        for (auto &k : collect) {
+          if (k == name) {
+            headers[name] = h.substr(h.find_first_not_of(' ', c + 1));
+          }
+        }
+      }
+      i = n + 2;
+    }
+    return true;
+  }
+
+  int port;
+  int fd, cfd;
+  std::map<std::string, THandlerFunction> handlers;
+  THandlerFunction not_found;
+  std::vector<std::string> collect;
+
+  // current request
+  std::string path;
+  HTTPMethod request_method;
+  bool http11;
+  std::map<std::string, std::string> args, headers;
+  size_t content_length;
+  bool chunked;
+  std::string extra_headers;
+};
+
+#endif
@@ -0,0 +1,387 @@
+// HTTP load test of the www pages (include/web.h) built for a PC
+//
+// loadtest [-c clients] [-d seconds] [-H hours] [-m mix] [-l label] [-p port]
+//          [-e] [-z]
+//   -c  concurrent clients (default 4)
+//   -d  test duration (default 10 s)
+//   -H  hours of history on the fake device (default 744)
+//   -m  request mix, "path:weight,..." (default: see MIX below)
+//   -l  label for the report lines (build name, commit...)
+//   -e  clients revalidate with the last ETag they got (If-None-Match)
+//   -z  clients take gzip (Accept-Encoding)
+//
+// the pages run on a single-threaded ESP8266WebServer stand-in
+// (tools/host/web_server.h), with history and files in RAM. clients use
+// HTTP/1.1 and count response bytes and chunks.
+//
+// report is tab separated, one line per route, so runs of different builds
+// can be concatenated and compared:
+//   label route requests errors req/s p50_ms p99_ms p99.9_ms bytes chunks 304s
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "host/arduino.h"
+#include "host/mem_storage.h"
+#include "host/web_server.h"
+
+#include "../include/csv_export.h"
+#include "../include/csv_import.h"
+#include "../include/history.h"
+
+#define PORT 8266
+#define MIX                                                                    \
+  "/:20,/data.js:20,/raw:30,/files:10,/description.xml:10,/files?n=%s:10"
+
+unsigned long sched_millis() { return 0; }
+unsigned long sched_micros() { return 0; }
+
+// what web.h needs from main.cpp
+#define ENABLE_WWW_UPLOAD
+#define GRAPH_RANGE 24 * 7
+
+ESP8266WebServer server;
+MemStorage storage;
+History history(storage, "/CACHE");
+float temperature, humidity;
+
+void get_sensors() {
+  temperature = 20 + (rand() % 100) / 10.0;
+  humidity = 50 + (rand() % 100) / 10.0;
+}
+
+// SSDP_esp8266.schema() writes a whole HTTP reply
+struct {
+  void schema(WiFiClient client) {
+    client.printf(
+        "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\nContent-Length: %d\r\n"
+        "Connection: close\r\nAccess-Control-Allow-Origin: *\r\n\r\n%s",
+        (int)strlen(xml), xml);
+  }
+  const char *xml =
+      "<?xml version=\"1.0\"?><root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+      "<specVersion><major>1</major><minor>0</minor></specVersion>"
+      "<URLBase>http://127.0.0.1:80/</URLBase><device>"
+      "<deviceType>urn:schemas-upnp-org:device:CLIMA:1</deviceType>"
+      "<friendlyName>CLIMA</friendlyName><presentationURL>/</presentationURL>"
+      "<serialNumber>1234567</serialNumber><modelName>CLIMA</modelName>"
+      "<modelNumber>1</modelNumber><modelURL></modelURL>"
+      "<manufacturer>JMGK</manufacturer>"
+      "<manufacturerURL>http://www.jmgk.com.br/</manufacturerURL>"
+      "<UDN>uuid:38323636-4558-4dda-9188-cda0e6123456</UDN></device></root>";
+} SSDP_esp8266;
+
+#include "../include/web.h"
+
+/*
+clients
+*/
+
+struct Route {
+  std::string path;
+  int weight;
+  std::mutex lock;
+  std::vector<double> ms;
+  unsigned long errors = 0;
+  unsigned long long bytes = 0, chunks = 0;
+  unsigned long not_modified = 0;
+};
+
+std::vector<Route *> routes;
+std::atomic<bool> running(true);
+int port = PORT;
+bool revalidate, compressed;
+
+// count chunks of a chunked body, -1 if broken
+long count_chunks(const std::string &body) {
+  long chunks = 0;
+  size_t i = 0;
+  for (;;) {
+    size_t e = body.find("\r\n", i);
+    if (e == std::string::npos) {
+      return -1;
+    }
+    size_t n = strtoul(body.c_str() + i, NULL, 16);
+    if (!n) {
+      return chunks;
+    }
+    chunks++;
+    i = e + 2 + n + 2;
+  }
+}
+
+bool request(const std::string &path, std::string &etag, size_t &bytes,
+             long &chunks, bool &not_modified) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&a, sizeof(a))) {
+    close(fd);
+    return false;
+  }
+  std::string req = "GET " + path +
+                    " HTTP/1.1\r\nHost: clima\r\nUser-Agent: loadtest\r\n";
+  if (compressed) {
+    req += "Accept-Encoding: gzip\r\n";
+  }
+  if (etag.size()) {
+    req += "If-None-Match: " + etag + "\r\n";
+  }
+  req += "Connection: close\r\n\r\n";
+  send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+  std::string reply;
+  char buf[8192];
+  ssize_t r;
+  while ((r = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    reply.append(buf, r);
+  }
+  close(fd);
+
+  bytes = reply.size();
+  size_t e = reply.find("\r\n\r\n");
+  if ((e == std::string::npos) || (reply.compare(0, 12, "HTTP/1.1 200") &&
+                                   reply.compare(0, 12, "HTTP/1.1 304"))) {
+    return false;
+  }
+  std::string headers = reply.substr(0, e);
+  std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+  not_modified = !reply.compare(0, 12, "HTTP/1.1 304");
+  size_t t = headers.find("\r\netag: ");
+  if (revalidate && (t != std::string::npos)) {
+    t += 8;
+    etag = reply.substr(t, headers.find("\r\n", t) - t);
+  }
+  chunks = 1;
+  if (headers.find("transfer-encoding: chunked") != std::string::npos) {
+    chunks = count_chunks(reply.substr(e + 4));
+  }
+  return chunks >= 0;
+}
+
+void client(unsigned seed) {
+  std::mt19937 rng(seed);
+  int total = 0;
+  for (auto r : routes) {
+    total += r->weight;
+  }
+  std::uniform_int_distribution<int> pick(0, total - 1);
+  std::vector<std::string> etags(routes.size());
+  while (running) {
+    int w = pick(rng);
+    size_t n = 0;
+    while ((w -= routes[n]->weight) >= 0) {
+      n++;
+    }
+    Route *r = routes[n];
+    size_t bytes = 0;
+    long chunks = 0;
+    bool not_modified = false;
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = request(r->path, etags[n], bytes, chunks, not_modified);
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count();
+    std::lock_guard<std::mutex> l(r->lock);
+    if (ok) {
+      r->ms.push_back(ms);
+      r->bytes += bytes;
+      r->chunks += chunks;
+      r->not_modified += not_modified;
+    } else {
+      r->errors++;
+    }
+  }
+}
+
+double percentile(std::vector<double> &v, double p) {
+  if (v.empty()) {
+    return 0;
+  }
+  size_t i = (size_t)ceil(p / 100 * v.size());
+  return v[std::min(v.size() - 1, i ? i - 1 : 0)];
+}
+
+/*
+main
+*/
+
+void usage() {
+  fprintf(stderr, "loadtest [-c clients] [-d seconds] [-H hours] [-m mix] "
+                  "[-l label] [-p port] [-e] [-z]\n");
+  exit(1);
+}
+
+// fake device: history plus three monthly archives (imported)
+void populate(int hours) {
+  time_t t = time(NULL) - (time_t)(hours + 24 * 93) * 3600;
+  t -= t % 3600;
+  CsvExport csv_export(storage);
+  for (int m = 0; m < 3; m++) {
+    char name[32];
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(name, sizeof(name), "/%m%Y.csv", &tm);
+    for (int i = 0; i < 24 * 31; i++, t += 3600) {
+      get_sensors();
+      TH_INFO e = {t, temperature, humidity};
+      storage.append("/MONTH", &e, sizeof(e));
+    }
+    csv_export.add("/MONTH", 0, 24 * 31, name, true);
+    csv_export.run();
+  }
+  CsvImport csv_import(storage);
+  csv_import.scan();
+  csv_import.run();
+  for (int i = 0; i < hours; i++, t += 3600) {
+    get_sensors();
+    history.append(TH_INFO{t, temperature, humidity});
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int clients = 4, seconds = 10, hours = 24 * 31;
+  std::string mix, label = "-";
+  int c;
+  while ((c = getopt(argc, argv, "c:d:H:m:l:p:ez")) != -1) {
+    switch (c) {
+    case 'c':
+      clients = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'H':
+      hours = atoi(optarg);
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    case 'l':
+      label = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'e':
+      revalidate = true;
+      break;
+    case 'z':
+      compressed = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((clients < 1) || (seconds < 1)) {
+    usage();
+  }
+
+  setenv("TZ", "<-03>3", 1);
+  tzset();
+  srand(1);
+  populate(hours);
+
+  // default mix downloads the first CSV archive
+  if (mix.empty()) {
+    std::string csv = "/CACHE";
+    for (auto &f : storage.files) {
+      if ((f.first.size() > 4) &&
+          !f.first.compare(f.first.size() - 4, 4, ".csv")) {
+        csv = f.first;
+        break;
+      }
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf), MIX, csv.c_str());
+    mix = buf;
+  }
+  size_t i = 0;
+  while (i < mix.size()) {
+    size_t e = mix.find(',', i);
+    if (e == std::string::npos) {
+      e = mix.size();
+    }
+    std::string item = mix.substr(i, e - i);
+    size_t colon = item.rfind(':');
+    Route *r = new Route;
+    r->path = item.substr(0, colon);
+    r->weight = (colon == std::string::npos) ? 1 : atoi(item.c_str() + colon + 1);
+    if (r->weight > 0) {
+      routes.push_back(r);
+    }
+    i = e + 1;
+  }
+  if (routes.empty()) {
+    usage();
+  }
+
+  // device
+  if (!server.begin(port)) {
+    fprintf(stderr, "Cant listen on %d\n", port);
+    return 1;
+  }
+  web_begin();
+  std::atomic<bool> serving(true);
+  std::thread device([&serving]() {
+    while (serving) {
+      server.handleClient();
+    }
+  });
+
+  // load
+  std::vector<std::thread> threads;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < clients; i++) {
+    threads.emplace_back(client, 1000 + i);
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  running = false;
+  // serve what's still queued
+  for (auto &t : threads) {
+    t.join();
+  }
+  serving = false;
+  device.join();
+  double secs =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+          .count();
+
+  // report
+  printf("# label\troute\trequests\terrors\treq/s\tp50_ms\tp99_ms\tp99.9_ms\t"
+         "bytes\tchunks\t304s\n");
+  std::vector<double> all;
+  unsigned long errors = 0;
+  for (auto r : routes) {
+    std::sort(r->ms.begin(), r->ms.end());
+    size_t n = r->ms.size();
+    printf("%s\t%s\t%zu\t%lu\t%.1f\t%.3f\t%.3f\t%.3f\t%.0f\t%.1f\t%lu\n",
+           label.c_str(), r->path.c_str(), n, r->errors, n / secs,
+           percentile(r->ms, 50), percentile(r->ms, 99),
+           percentile(r->ms, 99.9), n ? (double)r->bytes / n : 0.0,
+           n ? (double)r->chunks / n : 0.0, r->not_modified);
+    all.insert(all.end(), r->ms.begin(), r->ms.end());
+    errors += r->errors;
+  }
+  std::sort(all.begin(), all.end());
+  printf("%s\tTOTAL\t%zu\t%lu\t%.1f\t%.3f\t%.3f\t%.3f\t-\t-\t-\n", label.c_str(),
+         all.size(), errors, all.size() / secs, percentile(all, 50),
+         percentile(all, 99), percentile(all, 99.9));
+  return 0;
+}
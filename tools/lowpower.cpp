@@ -0,0 +1,366 @@
+// run the low power wake/sleep cycle (include/low_power.h) on a virtual clock
+//
+// lowpower [-d days] [-n batch] [-f fail%] [-k ppm] [-c cuts] [-s seed]
+//   -d  days to simulate (default 365)
+//   -n  samples per radio wake, LowPower caps it at LOW_POWER_SAMPLES / 2
+//       (default 12)
+//   -f  WiFi connection failures in % (default 10)
+//   -k  sleep timer error in ppm, +-10% of it changes every sleep
+//       (default 20000)
+//   -c  power cuts per year, RTC memory is lost (default 0)
+//   -s  random seed (default 1)
+//
+// every wake runs the same steps as low_power_wake() in main.cpp, with fresh
+// objects (RAM is lost in deep sleep); only RTC memory and the files (in
+// RAM, counted) survive. at the end every sample must be in /CACHE or in one
+// monthly CSV, exactly once, with the right values and close to the real
+// time it was taken, and published once (LowPower::publish, as main.cpp
+// does) unless it is still waiting for a connection. samples still
+// buffered, or lost with RTC memory on a power cut, are reported apart.
+// energy comes from a simple current model and is compared with the always
+// on firmware.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../include/logger.h"
+#include "../include/low_power.h"
+#include "host/check.h"
+#include "host/mem_storage.h"
+
+#define START 1704078000 // 2024-01-01 00:00 -03
+#define PERIOD 3600
+
+// current model (A) and times (s), ESP8266 module at 3.3 V
+#define VOLTS 3.3
+#define SLEEP_A 20e-6
+#define AWAKE_A 15e-3     // radio off
+#define RADIO_A 70e-3     // radio on
+#define ALWAYS_ON_A 75e-3 // www, discovery, modem sleep off
+#define BOOT_S 0.1        // boot, sensor
+#define CONNECT_S 1.5     // WiFi connect, plus up to 2.5 s more
+#define TIMEOUT_S 10      // failed connect (LOW_POWER_WIFI)
+#define NTP_S 0.3
+#define FLUSH_S 0.2 // flash, export, MQTT
+
+unsigned long sched_millis() { return 0; }
+unsigned long sched_micros() { return 0; }
+
+// real time
+double real_t;
+
+// what was sampled, in order
+struct sample {
+  double real;
+  TH_INFO e;
+  bool cut;
+};
+std::vector<sample> logged;
+
+// what the broker got, unpublished entries that went to a monthly CSV or
+// were forgotten on a power cut
+std::map<time_t, TH_INFO> published;
+unsigned long resent, skipped, forgotten;
+
+// the device: flash and RTC memory
+MemStorage storage;
+rtc_data rtc_memory;
+unsigned int batch = 12;
+int wifi_fail = 10;
+
+// stats
+unsigned long wakes, radio_wakes, wifi_fails, flushes;
+double awake_s, radio_s, sleep_s;
+
+void no_sensor(float &, float &) {}
+
+void store(const TH_INFO &e, void *arg) { ((Logger *)arg)->store(e); }
+
+bool send(const TH_INFO &e, void *) {
+  if (published.count(e.tempo)) {
+    resent++;
+  }
+  published[e.tempo] = e;
+  return true;
+}
+
+// one wake, returns the sleep time asked for (us)
+uint64_t wake(bool woke, bool rf, bool &rf_next) {
+  rtc_data rtc;
+  memcpy(&rtc, &rtc_memory, sizeof(rtc));
+  LowPower low_power(rtc, batch, PERIOD);
+  low_power.begin(woke);
+  bool radio = low_power.radio();
+  double t = BOOT_S;
+  bool online = false;
+  wakes++;
+
+  if (radio) {
+    radio_wakes++;
+    // the radio is off if the last sleep didnt ask for it
+    if (rf && (rand() % 100 >= wifi_fail)) {
+      t += CONNECT_S + (rand() % 2500) / 1000.0 + NTP_S;
+      low_power.sync((time_t)(real_t + t), t * 1000);
+      online = true;
+    } else {
+      t += TIMEOUT_S;
+      wifi_fails++;
+    }
+  }
+
+  // sensor
+  if (rtc.clock) {
+    size_t i = logged.size();
+    float temperature = 20 + (i % 97) / 10.0f;
+    float humidity = 50 + (i % 89) / 10.0f;
+    logged.push_back(sample{real_t + t, {0, temperature, humidity}, 0});
+    low_power.add(temperature, humidity);
+  }
+
+  if (low_power.full()) {
+    History history(storage, "/CACHE");
+    CsvExport csv_export(storage);
+    Logger logger(storage, history, csv_export, no_sensor);
+    history.begin();
+    if (online) {
+      low_power.publish(history, send, nullptr);
+      skipped += low_power.skipped;
+    }
+    logger.begin(rtc.sample[0].tempo);
+    low_power.flush(store, &logger);
+    csv_export.run();
+    t += FLUSH_S;
+    flushes++;
+  }
+
+  low_power.seal();
+  memcpy(&rtc_memory, &rtc, sizeof(rtc));
+  rf_next = low_power.radio();
+  awake_s += t;
+  if (radio) {
+    radio_s += t;
+  }
+  real_t += t;
+  return low_power.sleep_us(t * 1000);
+}
+
+/*
+checks
+*/
+
+std::map<double, size_t> by_time;
+std::vector<int> found;
+std::set<time_t> stored;
+double max_skew, sum_skew;
+
+// match an entry to the sample taken closest to its time
+void seen(const TH_INFO &e, const char *file, bool rounded) {
+  stored.insert(e.tempo);
+  auto i = by_time.lower_bound(e.tempo);
+  if ((i == by_time.end()) ||
+      ((i != by_time.begin()) &&
+       (e.tempo - std::prev(i)->first < i->first - e.tempo))) {
+    i = (i == by_time.begin()) ? i : std::prev(i);
+  }
+  double skew = (i == by_time.end()) ? PERIOD : fabs(i->first - e.tempo);
+  if (skew >= PERIOD / 2) {
+    error("%s: entry %ld was never sampled", file, (long)e.tempo);
+    return;
+  }
+  const sample &s = logged[i->second];
+  float dt = fabs(s.e.temperature - e.temperature);
+  float dh = fabs(s.e.humidity - e.humidity);
+  if ((dt > (rounded ? 0.051 : 0)) || (dh > (rounded ? 0.051 : 0))) {
+    error("%s: entry %ld has wrong values", file, (long)e.tempo);
+  }
+  max_skew = (skew > max_skew) ? skew : max_skew;
+  sum_skew += skew;
+  found[i->second]++;
+}
+
+void check(size_t pending) {
+  for (size_t i = 0; i < logged.size(); i++) {
+    by_time[logged[i].real] = i;
+  }
+  found.assign(logged.size(), 0);
+  size_t monthly = 0;
+
+  for (auto &f : storage.files) {
+    const char *name = f.first.c_str();
+    if (f.first == "/CACHE") {
+      cache_entries(f.second, [&](const TH_INFO &e) { seen(e, name, false); });
+      continue;
+    }
+    int m = 0, y = 0;
+    if ((f.first.size() != 11) || f.first.compare(7, 4, ".csv") ||
+        (sscanf(name, "/%2d%4d", &m, &y) != 2)) {
+      error("unexpected file %s", name);
+      continue;
+    }
+    monthly++;
+    csv_rows(f.second, name, [&](const TH_INFO &row) {
+      struct tm tm;
+      localtime_r(&row.tempo, &tm);
+      if ((tm.tm_mon + 1 != m) || (tm.tm_year + 1900 != y)) {
+        error("%s: row from %02d-%04d", name, tm.tm_mon + 1,
+              tm.tm_year + 1900);
+      }
+      seen(row, name, true);
+    });
+  }
+
+  // every sample exactly once, but the ones in RTC memory
+  size_t lost = 0, dup = 0, cut = 0, ok = 0;
+  for (size_t i = 0; i < logged.size(); i++) {
+    if (found[i] > 1) {
+      dup++;
+    } else if (found[i]) {
+      ok++;
+    } else if (logged[i].cut) {
+      cut++;
+    } else if (i < logged.size() - pending) {
+      lost++;
+    }
+  }
+  if (lost) {
+    error("%zu samples lost", lost);
+  }
+  if (dup) {
+    error("%zu samples duplicated", dup);
+  }
+  for (auto &p : published) {
+    if (!stored.count(p.first)) {
+      error("published entry %ld isnt in flash", (long)p.first);
+    }
+  }
+  // every stored sample once, but the ones waiting for the next publish
+  size_t due = ok - rtc_memory.unpublished - skipped - forgotten;
+  if (published.size() != due) {
+    error("%zu published, %zu due", published.size(), due);
+  }
+  if (resent) {
+    error("%lu entries published again", resent);
+  }
+  printf("files: %zu monthly\n", monthly);
+  printf("samples: %zu taken, %zu stored, %zu in RTC memory, %zu lost on "
+         "power cuts\n",
+         logged.size(), ok, pending, cut);
+  printf("mqtt: %zu published, %u waiting, %lu skipped (month changed "
+         "offline), %lu forgotten on power cuts\n",
+         published.size(), rtc_memory.unpublished, skipped, forgotten);
+  printf("time error: %.1f s max, %.1f s mean, timer calibrated to %d ppm\n",
+         max_skew, ok ? sum_skew / ok : 0.0, rtc_memory.drift);
+}
+
+/*
+main
+*/
+
+void usage() {
+  fprintf(stderr, "lowpower [-d days] [-n batch] [-f fail%%] [-k ppm] "
+                  "[-c cuts] [-s seed]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  double days = 365, cuts = 0;
+  long ppm = 20000;
+  int c;
+  srand(1);
+  while ((c = getopt(argc, argv, "d:n:f:k:c:s:")) != -1) {
+    switch (c) {
+    case 'd':
+      days = atof(optarg);
+      break;
+    case 'n':
+      batch = atoi(optarg);
+      break;
+    case 'f':
+      wifi_fail = atoi(optarg);
+      break;
+    case 'k':
+      ppm = atol(optarg);
+      break;
+    case 'c':
+      cuts = atof(optarg);
+      break;
+    case 's':
+      srand(atoi(optarg));
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((days <= 0) || (batch < 1) || (batch > LOW_POWER_SAMPLES) ||
+      (wifi_fail < 0) || (wifi_fail > 100)) {
+    usage();
+  }
+
+  // same time zone as the device
+  setenv("TZ", "<-03>3", 1);
+  tzset();
+
+  real_t = START;
+  double end_t = real_t + days * 86400;
+  bool woke = false, rf = true, rf_next;
+  unsigned long power_cuts = 0;
+  while (real_t < end_t) {
+    uint64_t us = wake(woke, rf, rf_next);
+    double jitter = ppm * ((rand() % 201) - 100) / 1000.0;
+    double s = us / 1e6 * (1 + (ppm + jitter) / 1e6);
+    sleep_s += s;
+    real_t += s;
+    woke = true;
+    rf = rf_next;
+    if (cuts && (rand() < cuts * s / (365.25 * 86400) * RAND_MAX)) {
+      // buffered samples go with the RTC memory, off for up to a day
+      for (size_t i = 0; i < rtc_memory.count; i++) {
+        logged[logged.size() - 1 - i].cut = true;
+      }
+      forgotten += rtc_memory.unpublished;
+      for (size_t i = 0; i < sizeof(rtc_memory); i++) {
+        ((uint8_t *)&rtc_memory)[i] = rand();
+      }
+      real_t += rand() % 86400;
+      woke = false;
+      rf = true;
+      power_cuts++;
+    }
+  }
+
+  // report
+  double hours = (real_t - START) / 3600;
+  printf("simulated: %.0f days, %lu wakes (%lu with radio, %lu WiFi "
+         "failures), %lu flushes, %lu power cuts\n",
+         hours / 24, wakes, radio_wakes, wifi_fails, flushes, power_cuts);
+  printf("written: %llu bytes in %lu appends\n", storage.bytes_written,
+         storage.appends);
+  printf("awake: %.0f s (%.0f s radio), asleep: %.0f s (%.3f%% duty)\n",
+         awake_s, radio_s, sleep_s, 100 * awake_s / (awake_s + sleep_s));
+
+  // what RTC memory still holds, nothing if the run ended on a power cut
+  LowPower low_power(rtc_memory, batch, PERIOD);
+  low_power.begin(woke);
+  check(rtc_memory.count);
+
+  // energy
+  double j = VOLTS * ((awake_s - radio_s) * AWAKE_A + radio_s * RADIO_A +
+                      sleep_s * SLEEP_A);
+  double always = VOLTS * ALWAYS_ON_A * (awake_s + sleep_s);
+  size_t n = logged.size() ? logged.size() : 1;
+  printf("energy: %.1f J, %.3f J/sample (always on: %.0f J, %.1f J/sample, "
+         "%.0fx), %.0f mAh/year\n",
+         j, j / n, always, always / n, always / j,
+         j / VOLTS / 3.6 / (hours / (24 * 365.25)));
+
+  printf("%s\n", errors ? "FAILED" : "OK");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,314 @@
+// MQTT broker and stations stand-in, checks what collector -b stores
+//
+// mqttsim [-c collector] [-n stations] [-r rounds] [-s seed]
+//   -c  collector binary (default ./collector)
+//   -n  always on stations, as many low power ones (default 4)
+//   -r  samples per station (default 50)
+//   -s  random seed (default 1)
+//
+// runs the collector on a fresh store against a one client broker on a
+// local port. each always on station sends the shared CLIMA/IP,
+// CLIMA/TEMPERATURE, CLIMA/HUMIDITY and its CLIMA/LIVE/<id>, each low power
+// one CLIMA/BATCH/<id> samples; stations interleave message by message,
+// like on a busy broker. then the store is queried: every sample must be
+// under its own station and series, exactly once, and nothing else stored.
+
+#include <dirent.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "host/check.h"
+
+#define START 1760000000LL
+#define WAIT_S 10
+
+struct Message {
+  std::string topic, payload;
+};
+
+// expected query output per station/series
+std::map<std::string, std::vector<std::string>> expected;
+
+std::string row(long long t, float temperature, float humidity) {
+  char buf[32], line[64];
+  time_t tt = t;
+  strftime(buf, sizeof(buf), "%FT%TZ", gmtime(&tt));
+  snprintf(line, sizeof(line), "%s, %.01f, %.01f", buf, temperature, humidity);
+  return line;
+}
+
+std::string sample(long long t, float temperature, float humidity) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%lld, %.2f, %.2f", t, temperature, humidity);
+  return buf;
+}
+
+/*
+broker
+*/
+
+bool recv_packet(int fd, uint8_t &type) {
+  struct pollfd pf = {fd, POLLIN, 0};
+  uint8_t b;
+  size_t n = 0, mul = 1;
+  if ((poll(&pf, 1, WAIT_S * 1000) <= 0) || (read(fd, &type, 1) != 1)) {
+    return false;
+  }
+  do {
+    if (read(fd, &b, 1) != 1) {
+      return false;
+    }
+    n += (b & 0x7f) * mul;
+    mul *= 128;
+  } while (b & 0x80);
+  std::string p(n, 0);
+  for (size_t i = 0; i < n;) {
+    ssize_t r = read(fd, &p[i], n - i);
+    if (r <= 0) {
+      return false;
+    }
+    i += r;
+  }
+  return true;
+}
+
+bool send_packet(int fd, uint8_t type, const std::string &payload) {
+  std::string p(1, (char)type);
+  size_t n = payload.size();
+  do {
+    uint8_t b = n % 128;
+    n /= 128;
+    p += (char)(n ? (b | 0x80) : b);
+  } while (n);
+  p += payload;
+  return write(fd, p.data(), p.size()) == (ssize_t)p.size();
+}
+
+bool publish(int fd, const Message &m) {
+  std::string p;
+  p += (char)(m.topic.size() >> 8);
+  p += (char)(m.topic.size() & 0xff);
+  p += m.topic + m.payload;
+  return send_packet(fd, 0x30, p);
+}
+
+/*
+stations
+*/
+
+std::vector<std::vector<Message>> stations(int n, int rounds) {
+  std::vector<std::vector<Message>> s;
+  char id[16], buf[32];
+  for (int i = 0; i < 2 * n; i++) {
+    bool live = i < n;
+    snprintf(id, sizeof(id), "%08X", (live ? 0x00a1b200 : 0x00c0ff00) + i);
+    s.emplace_back();
+    for (int r = 0; r < rounds; r++) {
+      float temperature = 20 + ((i * 7 + r) % 100) / 10.0f;
+      float humidity = 50 + ((i * 3 + r) % 100) / 10.0f;
+      // live every minute, batches are hourly samples
+      long long t = START + (live ? r * 60LL : r * 3600LL);
+      if (live) {
+        snprintf(buf, sizeof(buf), "10.0.0.%d", i + 1);
+        s.back().push_back({"CLIMA/IP", buf});
+        snprintf(buf, sizeof(buf), "%.2f", temperature);
+        s.back().push_back({"CLIMA/TEMPERATURE", buf});
+        snprintf(buf, sizeof(buf), "%.2f", humidity);
+        s.back().push_back({"CLIMA/HUMIDITY", buf});
+        s.back().push_back({std::string("CLIMA/LIVE/") + id,
+                            sample(t, temperature, humidity)});
+        if (!(r % 10)) {
+          s.back().push_back({std::string("CLIMA/ALERT/") + id + "/0",
+                              (r % 20) ? "OFF" : "ON"});
+        }
+        expected[std::string(id) + " live"].push_back(
+            row(t, temperature, humidity));
+      } else {
+        s.back().push_back({std::string("CLIMA/BATCH/") + id,
+                            sample(t, temperature, humidity)});
+        expected[std::string(id) + " hourly"].push_back(
+            row(t, temperature, humidity));
+      }
+    }
+  }
+  return s;
+}
+
+/*
+checks
+*/
+
+std::vector<std::string> query(const char *collector, const char *dir,
+                               const std::string &id,
+                               const std::string &series) {
+  std::string cmd = std::string(collector) + " query -d " + dir + " -s " +
+                    series + " " + id + " 0 4000000000 2>/dev/null";
+  std::vector<std::string> rows;
+  FILE *f = popen(cmd.c_str(), "r");
+  char line[128];
+  while (f && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = 0;
+    rows.push_back(line);
+  }
+  if (f) {
+    pclose(f);
+  }
+  return rows;
+}
+
+void check(const char *collector, const char *dir) {
+  std::map<std::string, bool> ids;
+  size_t rows = 0;
+  for (auto &e : expected) {
+    std::string id = e.first.substr(0, e.first.find(' '));
+    std::string series = e.first.substr(e.first.find(' ') + 1);
+    ids[id] = true;
+    auto got = query(collector, dir, id, series);
+    rows += got.size();
+    if (got != e.second) {
+      error("%s %s: %zu rows, expected %zu (or wrong values)", id.c_str(),
+            series.c_str(), got.size(), e.second.size());
+    }
+  }
+  // nothing under other names (IPs, "unknown")
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  while (d && (de = readdir(d))) {
+    if ((de->d_name[0] != '.') && !ids.count(de->d_name)) {
+      error("stored under unknown station %s", de->d_name);
+    }
+  }
+  if (d) {
+    closedir(d);
+  }
+  printf("store: %zu rows for %zu stations\n", rows, ids.size());
+}
+
+/*
+main
+*/
+
+void usage() {
+  fprintf(stderr, "mqttsim [-c collector] [-n stations] [-r rounds] "
+                  "[-s seed]\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  const char *collector = "./collector";
+  int n = 4, rounds = 50;
+  int c;
+  srand(1);
+  while ((c = getopt(argc, argv, "c:n:r:s:")) != -1) {
+    switch (c) {
+    case 'c':
+      collector = optarg;
+      break;
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    case 's':
+      srand(atoi(optarg));
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((n < 1) || (n > 200) || (rounds < 1)) {
+    usage();
+  }
+
+  // broker on any free local port
+  int ls = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in a = {};
+  socklen_t al = sizeof(a);
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((ls < 0) || bind(ls, (struct sockaddr *)&a, sizeof(a)) ||
+      listen(ls, 1) || getsockname(ls, (struct sockaddr *)&a, &al)) {
+    perror("broker");
+    return 1;
+  }
+  char broker[32], dir[] = "/tmp/mqttsim.XXXXXX";
+  snprintf(broker, sizeof(broker), "127.0.0.1:%d", ntohs(a.sin_port));
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  pid_t pid = fork();
+  if (!pid) {
+    if (!freopen("/dev/null", "w", stdout)) {
+      _exit(1);
+    }
+    execl(collector, collector, "-d", dir, "-b", broker, "-i", "3600",
+          (char *)NULL);
+    perror(collector);
+    _exit(1);
+  }
+
+  // CONNECT / CONNACK, SUBSCRIBE / SUBACK
+  struct pollfd pf = {ls, POLLIN, 0};
+  int fd = (poll(&pf, 1, WAIT_S * 1000) > 0) ? accept(ls, NULL, NULL) : -1;
+  uint8_t type;
+  if ((fd < 0) || !recv_packet(fd, type) || (type != 0x10) ||
+      !send_packet(fd, 0x20, std::string("\0\0", 2)) ||
+      !recv_packet(fd, type) || ((type & 0xf0) != 0x80) ||
+      !send_packet(fd, 0x90, std::string("\0\1\0", 3))) {
+    error("collector didnt subscribe");
+  }
+
+  // interleave, each station's messages stay in order
+  size_t sent = 0;
+  auto s = stations(n, rounds);
+  std::vector<size_t> next(s.size(), 0);
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < s.size(); i++) {
+    pending.push_back(i);
+  }
+  while (!errors && pending.size()) {
+    size_t k = rand() % pending.size();
+    size_t i = pending[k];
+    if (!publish(fd, s[i][next[i]++])) {
+      error("publish failed");
+    }
+    sent++;
+    if (next[i] == s[i].size()) {
+      pending.erase(pending.begin() + k);
+    }
+  }
+
+  // let it store, then stop it
+  sleep(2);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  printf("sent: %zu messages from %d stations\n", sent, 2 * n);
+
+  if (!errors) {
+    check(collector, dir);
+  }
+  std::string rm = std::string("rm -rf ") + dir;
+  if (system(rm.c_str())) {
+    fprintf(stderr, "cant remove %s\n", dir);
+  }
+  printf("%s\n", errors ? "FAILED" : "OK");
+  return errors ? 1 : 0;
+}
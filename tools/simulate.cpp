@@ -0,0 +1,390 @@
+// run the logging state machine (include/logger.h) on a virtual clock
+//
+// simulate [-y years] [-s YYYY-MM-DD] [-t step] [-b hours] [-e us]
+//          [-o dir] [-r CACHE ...]
+//   -y  years to simulate (default 10)
+//   -s  start date (default first replayed entry, or 2024-01-01)
+//   -t  virtual seconds per loop (default 60)
+//   -b  reboot about every N hours (pending exports are lost, /MONTH resumes)
+//   -e  export slice budget in us (default 200)
+//   -o  write the resulting files to dir
+//   -r  replay temperature/humidity from recorded CACHE files
+//
+// files live in RAM, bytes/calls are counted. at the end every logged
+// sample must be in exactly one monthly CSV (or in /CACHE), in the right
+// month, with the right values. monthly CSVs are imported back to binary
+// like on the device, each /MMYYYY.bin must match its CSV.
+//
+// build with -DDAILY_FILE to simulate daily files too
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../include/csv_import.h"
+#include "../include/logger.h"
+#include "../include/scheduler.h"
+#include "host/check.h"
+#include "host/mem_storage.h"
+
+#define START "2024-01-01"
+
+// virtual clock
+time_t now_t, start_t;
+
+unsigned long sched_millis() { return (now_t - start_t) * 1000UL; }
+unsigned long sched_micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// sensor feed
+std::vector<TH_INFO> replay;
+size_t replay_index;
+std::map<time_t, TH_INFO> logged;
+
+void sim_sensor(float &temperature, float &humidity) {
+  if (replay.size()) {
+    const TH_INFO &e = replay[replay_index++ % replay.size()];
+    temperature = e.temperature;
+    humidity = e.humidity;
+  } else {
+    // daily and yearly cycles, some noise
+    double d = (now_t - start_t) / 86400.0;
+    temperature = 22 + 6 * sin(2 * M_PI * (d - 0.4)) +
+                  5 * sin(2 * M_PI * d / 365) + (rand() % 100) / 100.0;
+    humidity = 60 - 15 * sin(2 * M_PI * (d - 0.4)) + (rand() % 100) / 50.0;
+  }
+  logged[now_t] = TH_INFO{now_t, temperature, humidity};
+}
+
+// the device (lost on reboot)
+MemStorage storage;
+std::unique_ptr<History> history;
+std::unique_ptr<CsvExport> csv_export;
+std::unique_ptr<CsvImport> csv_import;
+std::unique_ptr<Logger> logger;
+unsigned long samples, export_slices, import_slices;
+
+void boot() {
+  logger.reset();
+  csv_export.reset(new CsvExport(storage));
+  csv_import.reset(new CsvImport(storage));
+  history.reset(new History(storage, "/CACHE"));
+  logger.reset(new Logger(storage, *history, *csv_export, sim_sensor));
+  // partial imports
+  for (auto f = storage.files.begin(); f != storage.files.end();) {
+    f = (f->first.find(".tmp") != std::string::npos) ? storage.files.erase(f)
+                                                     : std::next(f);
+  }
+  history->begin();
+  logger->begin(now_t);
+  if (!csv_export->busy()) {
+    csv_import->scan();
+  }
+}
+
+bool task_log() {
+  samples += logger->tick(now_t);
+  return false;
+}
+
+bool task_export();
+bool task_import();
+
+Task tasks[] = {
+    TASK("log", 1000, 2, 50000, task_log),
+    TASK("export", 100, 0, 200, task_export),
+    TASK("import", 100, 0, 200, task_import),
+};
+Scheduler scheduler(tasks, sizeof(tasks) / sizeof(Task));
+
+bool task_export() {
+  if (!csv_export->busy()) {
+    return false;
+  }
+  export_slices++;
+  if (csv_export->run(&scheduler)) {
+    return true;
+  }
+  csv_import->scan();
+  return false;
+}
+
+bool task_import() {
+  if (!csv_import->busy()) {
+    return false;
+  }
+  import_slices++;
+  return csv_import->run(&scheduler);
+}
+
+/*
+checks
+*/
+
+void seen(std::map<time_t, int> &found, const TH_INFO &e, const char *file,
+          bool rounded) {
+  auto l = logged.find(e.tempo);
+  if (l == logged.end()) {
+    error("%s: entry %ld was never logged", file, (long)e.tempo);
+    return;
+  }
+  float dt = fabs(l->second.temperature - e.temperature);
+  float dh = fabs(l->second.humidity - e.humidity);
+  if ((dt > (rounded ? 0.051 : 0)) || (dh > (rounded ? 0.051 : 0))) {
+    error("%s: entry %ld has wrong values", file, (long)e.tempo);
+  }
+  found[e.tempo]++;
+}
+
+void check() {
+  std::map<time_t, int> found;
+  std::map<std::string, std::vector<TH_INFO>> monthly_rows;
+  size_t monthly = 0, daily = 0, imported = 0;
+
+  for (auto &f : storage.files) {
+    const char *name = f.first.c_str();
+    if (f.first == "/CACHE") {
+      // current month
+      cache_entries(f.second,
+                    [&](const TH_INFO &e) { seen(found, e, name, false); });
+      continue;
+    }
+    int d = 0, m = 0, y = 0;
+    bool csv = (f.first.size() > 4) && !f.first.compare(f.first.size() - 4, 4, ".csv");
+    bool is_month = csv && (f.first.size() == 11) &&
+                    (sscanf(name, "/%2d%4d", &m, &y) == 2);
+    bool is_day = csv && (f.first.size() == 13) &&
+                  (sscanf(name, "/%2d%2d%4d", &d, &m, &y) == 3);
+    if ((f.first.size() == 11) && !f.first.compare(7, 4, ".bin")) {
+      imported++;
+      continue;
+    }
+    if (!is_month && !is_day) {
+      error("unexpected file %s", name);
+      continue;
+    }
+    is_month ? monthly++ : daily++;
+
+    // rows all from this month/day
+    csv_rows(f.second, name, [&](const TH_INFO &row) {
+      struct tm tm;
+      localtime_r(&row.tempo, &tm);
+      if ((tm.tm_mon + 1 != m) || (tm.tm_year + 1900 != y) ||
+          (is_day && (tm.tm_mday != d))) {
+        error("%s: row from %02d-%02d-%04d", name, tm.tm_mday, tm.tm_mon + 1,
+              tm.tm_year + 1900);
+      }
+      if (is_month) {
+        seen(found, row, name, true);
+        monthly_rows[f.first.substr(0, 7)].push_back(row);
+      } else if (!logged.count(row.tempo)) {
+        error("%s: entry %ld was never logged", name, (long)row.tempo);
+      }
+    });
+  }
+
+  // every sample exactly once
+  size_t lost = 0, dup = 0;
+  for (auto &l : logged) {
+    auto f = found.find(l.first);
+    if (f == found.end()) {
+      lost++;
+    } else if (f->second > 1) {
+      dup++;
+    }
+  }
+  if (lost) {
+    error("%zu samples lost", lost);
+  }
+  if (dup) {
+    error("%zu samples duplicated", dup);
+  }
+
+  // imports match their CSV
+  for (auto &c : monthly_rows) {
+    auto b = storage.files.find(c.first + ".bin");
+    if (b == storage.files.end()) {
+      error("%s.csv was not imported", c.first.c_str());
+      continue;
+    }
+    if (b->second.size() != c.second.size() * sizeof(TH_INFO)) {
+      error("%s.bin has %zu entries, CSV has %zu rows", c.first.c_str(),
+            b->second.size() / sizeof(TH_INFO), c.second.size());
+      continue;
+    }
+    for (size_t i = 0; i < c.second.size(); i++) {
+      TH_INFO e;
+      memcpy(&e, b->second.data() + i * sizeof(e), sizeof(e));
+      if ((e.tempo != c.second[i].tempo) ||
+          (e.temperature != c.second[i].temperature) ||
+          (e.humidity != c.second[i].humidity)) {
+        error("%s.bin entry %zu differs from CSV", c.first.c_str(), i);
+        break;
+      }
+    }
+  }
+  printf("files: %zu monthly, %zu daily, %zu imported\n", monthly, daily,
+         imported);
+}
+
+/*
+main
+*/
+
+void usage() {
+  fprintf(stderr, "simulate [-y years] [-s YYYY-MM-DD] [-t step] [-b hours] "
+                  "[-e us] [-o dir] [-r CACHE ...]\n");
+  exit(1);
+}
+
+void load_replay(const char *name) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    fprintf(stderr, "Cant open %s\n", name);
+    exit(1);
+  }
+  TH_INFO e;
+  while (fread(&e, sizeof(e), 1, f) == 1) {
+    replay.push_back(e);
+  }
+  fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+  double years = 10;
+  const char *start = NULL, *out = NULL;
+  int step = 60, reboot = 0;
+  long budget = 0;
+  int c;
+  while ((c = getopt(argc, argv, "y:s:t:b:e:o:r:")) != -1) {
+    switch (c) {
+    case 'y':
+      years = atof(optarg);
+      break;
+    case 's':
+      start = optarg;
+      break;
+    case 't':
+      step = atoi(optarg);
+      break;
+    case 'b':
+      reboot = atoi(optarg);
+      break;
+    case 'e':
+      budget = atol(optarg);
+      break;
+    case 'o':
+      out = optarg;
+      break;
+    case 'r':
+      load_replay(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (step < 1) {
+    usage();
+  }
+  for (auto &t : tasks) {
+    if (budget && !strcmp(t.name, "export")) {
+      t.budget = budget;
+    }
+  }
+
+  // same time zone as the device
+  setenv("TZ", "<-03>3", 1);
+  tzset();
+
+  struct tm tm = {};
+  if (!start && replay.size()) {
+    start_t = replay[0].tempo;
+  } else {
+    if (sscanf(start ? start : START, "%d-%d-%d", &tm.tm_year, &tm.tm_mon,
+               &tm.tm_mday) != 3) {
+      usage();
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    tm.tm_isdst = -1;
+    start_t = mktime(&tm);
+  }
+  now_t = start_t;
+  time_t end_t = start_t + (time_t)(years * 365.25 * 86400);
+  time_t next_reboot = reboot ? now_t + (rand() % (2 * reboot) + 1) * 3600 : 0;
+  unsigned long reboots = 0, loops = 0;
+
+  // run
+  boot();
+  auto t0 = std::chrono::steady_clock::now();
+  while (now_t < end_t) {
+    now_t += step;
+    scheduler.run();
+    loops++;
+    if (next_reboot && (now_t >= next_reboot)) {
+      boot();
+      reboots++;
+      next_reboot = now_t + (rand() % (2 * reboot) + 1) * 3600;
+    }
+  }
+  // let the last export/import finish
+  while (csv_export->busy() || csv_import->busy()) {
+    now_t += step;
+    scheduler.run();
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                              t0)
+                    .count();
+
+  // report
+  double sim_hours = (now_t - start_t) / 3600.0;
+  printf("simulated: %.1f years (%.0f hours), %lu loops, %lu reboots\n",
+         sim_hours / (24 * 365.25), sim_hours, loops, reboots);
+  printf("wall time: %.3f s, %.0f loops/s, %.1f years/s\n", secs,
+         loops / secs, sim_hours / (24 * 365.25) / secs);
+  printf("samples: %lu logged\n", samples);
+  printf("written: %llu bytes in %lu appends (%.1f bytes/sample, %zu bytes "
+         "per entry)\n",
+         storage.bytes_written, storage.appends,
+         samples ? (double)storage.bytes_written / samples : 0.0,
+         sizeof(TH_INFO));
+  printf("read: %llu bytes in %lu reads\n", storage.bytes_read,
+         storage.reads);
+  printf("renames: %lu, removes: %lu\n", storage.renames, storage.removes);
+  for (size_t i = 0; i < scheduler.size(); i++) {
+    const Task &t = scheduler.task(i);
+    printf("task %s: %lu runs, %lu us max, %lu over budget\n", t.name, t.runs,
+           t.max_us, t.overruns);
+  }
+  printf("export slices: %lu, import slices: %lu (%lu rows, %lu bad lines)\n",
+         export_slices, import_slices, csv_import->rows, csv_import->errors);
+
+  check();
+
+  if (out) {
+    mkdir(out, 0755);
+    for (auto &f : storage.files) {
+      std::string name = std::string(out) + f.first;
+      FILE *o = fopen(name.c_str(), "wb");
+      if (o) {
+        fwrite(f.second.data(), 1, f.second.size(), o);
+        fclose(o);
+      }
+    }
+  }
+
+  printf("%s\n", errors ? "FAILED" : "OK");
+  return errors ? 1 : 0;
+}